@@ -0,0 +1,298 @@
+#include "corpus_generator.h"
+
+#include <array>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+#include "../src/tag_manager.h"
+#include <tpropertymap.h>
+
+namespace fs = std::filesystem;
+
+namespace {
+    void appendBE(std::string &out, std::uint64_t value, int bytes) {
+        for (int i = bytes - 1; i >= 0; i--) {
+            out += static_cast<char>((value >> (i * 8)) & 0xFF);
+        }
+    }
+
+    void appendLE(std::string &out, std::uint64_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out += static_cast<char>((value >> (i * 8)) & 0xFF);
+        }
+    }
+
+    std::string randomBytes(std::mt19937 &rng, std::size_t size) {
+        std::string result (size, '\0');
+        for (auto &c : result) c = static_cast<char>(rng() & 0xFF);
+        return result;
+    }
+
+    // MPEG-1 layer 3, 128 kbps, 44.1 kHz, stereo - 417 bytes per frame
+    std::string makeMp3(const CG::CorpusOptions &options) {
+        std::string out;
+
+        if (options.padding > 0) {
+            // empty ID3v2.4 tag that is nothing but padding, its size is stored as a syncsafe integer
+            out += "ID3\x04";
+            out += '\0';
+            out += '\0';
+            for (int i = 3; i >= 0; i--) {
+                out += static_cast<char>((options.padding >> (i * 7)) & 0x7F);
+            }
+            out.append(options.padding, '\0');
+        }
+
+        constexpr std::size_t frameSize = 417;
+        std::size_t frameCount = std::max<std::size_t>(options.audioBytes / frameSize, 1);
+        for (std::size_t i = 0; i < frameCount; i++) {
+            out += "\xFF\xFB\x90";
+            out += '\0';
+            out.append(frameSize - 4, '\0');
+        }
+        return out;
+    }
+
+    void appendFlacBlockHeader(std::string &out, bool last, int type, std::size_t length) {
+        out += static_cast<char>((last ? 0x80 : 0) | type);
+        appendBE(out, length, 3);
+    }
+
+    std::string makeFlac(const CG::CorpusOptions &options) {
+        std::string out = "fLaC";
+
+        // STREAMINFO, 44.1 kHz, stereo, 16 bit
+        appendFlacBlockHeader(out, options.padding == 0, 0, 34);
+        appendBE(out, 4096, 2); // min block size
+        appendBE(out, 4096, 2); // max block size
+        appendBE(out, 0, 3);    // min frame size (unknown)
+        appendBE(out, 0, 3);    // max frame size (unknown)
+        std::uint64_t totalSamples = options.audioBytes / 4;
+        appendBE(out, (std::uint64_t {44100} << 44) | (std::uint64_t {1} << 41) | (std::uint64_t {15} << 36) | totalSamples, 8);
+        out.append(16, '\0');   // MD5 of the audio (unknown)
+
+        if (options.padding > 0) {
+            appendFlacBlockHeader(out, true, 1, options.padding);
+            out.append(options.padding, '\0');
+        }
+
+        // frame sync code, the rest of the "audio" is never decoded
+        out += "\xFF\xF8";
+        out.append(std::max<std::size_t>(options.audioBytes, 2) - 2, '\0');
+        return out;
+    }
+
+    std::uint32_t oggCrc(const std::string &data) {
+        static const auto table = [] {
+            std::array<std::uint32_t, 256> result {};
+            for (std::uint32_t i = 0; i < 256; i++) {
+                std::uint32_t r = i << 24;
+                for (int bit = 0; bit < 8; bit++) {
+                    r = (r & 0x80000000) ? (r << 1) ^ 0x04C11DB7 : r << 1;
+                }
+                result[i] = r;
+            }
+            return result;
+        }();
+
+        std::uint32_t crc = 0;
+        for (char c : data) {
+            crc = (crc << 8) ^ table[((crc >> 24) & 0xFF) ^ static_cast<unsigned char>(c)];
+        }
+        return crc;
+    }
+
+    std::string makeOggPage(int headerType, std::uint64_t granule, std::uint32_t sequence, const std::vector<std::string> &packets) {
+        std::string segments;
+        std::string body;
+        for (auto &packet : packets) {
+            // lacing values, a packet ends with the first segment shorter than 255
+            for (std::size_t i = 0; i < packet.size() / 255; i++) segments += '\xFF';
+            segments += static_cast<char>(packet.size() % 255);
+            body += packet;
+        }
+
+        std::string page = "OggS";
+        page += '\0';
+        page += static_cast<char>(headerType);
+        appendLE(page, granule, 8);
+        appendLE(page, 0x45544147, 4); // stream serial
+        appendLE(page, sequence, 4);
+        appendLE(page, 0, 4);          // crc, filled in below
+        page += static_cast<char>(segments.size());
+        page += segments;
+        page += body;
+
+        std::uint32_t crc = oggCrc(page);
+        for (int i = 0; i < 4; i++) {
+            page[22 + i] = static_cast<char>((crc >> (i * 8)) & 0xFF);
+        }
+        return page;
+    }
+
+    std::string makeOgg(const CG::CorpusOptions &options) {
+        std::string identification = "\x01vorbis";
+        appendLE(identification, 0, 4);      // vorbis version
+        identification += '\x02';            // channels
+        appendLE(identification, 44100, 4);  // sample rate
+        appendLE(identification, 0, 4);      // max bitrate
+        appendLE(identification, 128000, 4); // nominal bitrate
+        appendLE(identification, 0, 4);      // min bitrate
+        identification += '\xB8';            // block sizes 256/2048
+        identification += '\x01';            // framing bit
+
+        std::string vendor = "epictag_bench";
+        std::string comment = "\x03vorbis";
+        appendLE(comment, vendor.size(), 4);
+        comment += vendor;
+        appendLE(comment, 0, 4);
+        comment += '\x01';
+
+        std::string setup = "\x05vorbis";
+        setup.append(32, '\0');
+
+        std::string out;
+        std::uint32_t sequence = 0;
+        out += makeOggPage(0x02, 0, sequence++, {identification});
+        out += makeOggPage(0x00, 0, sequence++, {comment, setup});
+
+        // audio pages of 50 packets with 1000 bytes each, the last one marks the end of the stream
+        constexpr std::size_t packetSize = 1000;
+        constexpr std::size_t packetsPerPage = 50;
+        std::size_t pageCount = std::max<std::size_t>(options.audioBytes / (packetSize * packetsPerPage), 1);
+        std::vector<std::string> packets (packetsPerPage, std::string(packetSize, '\0'));
+        for (std::size_t i = 0; i < pageCount; i++) {
+            bool last = i + 1 == pageCount;
+            out += makeOggPage(last ? 0x04 : 0x00, (i + 1) * 44100, sequence++, packets);
+        }
+        return out;
+    }
+
+    std::string makeAtom(const std::string &name, const std::string &payload) {
+        std::string out;
+        appendBE(out, payload.size() + 8, 4);
+        out += name;
+        out += payload;
+        return out;
+    }
+
+    std::string makeM4a(const CG::CorpusOptions &options) {
+        std::string ftyp = "M4A ";
+        appendBE(ftyp, 0, 4);
+        ftyp += "M4A mp42isom";
+
+        std::string mvhd;
+        appendBE(mvhd, 0, 4);                      // version + flags
+        appendBE(mvhd, 0, 4);                      // creation time
+        appendBE(mvhd, 0, 4);                      // modification time
+        appendBE(mvhd, 1000, 4);                   // timescale
+        appendBE(mvhd, options.audioBytes / 16, 4); // duration
+        appendBE(mvhd, 0x00010000, 4);             // rate
+        appendBE(mvhd, 0x0100, 2);                 // volume
+        mvhd.append(10, '\0');                     // reserved
+        for (std::uint32_t value : {0x00010000u, 0u, 0u, 0u, 0x00010000u, 0u, 0u, 0u, 0x40000000u}) {
+            appendBE(mvhd, value, 4);              // identity matrix
+        }
+        mvhd.append(24, '\0');                     // pre-defined
+        appendBE(mvhd, 2, 4);                      // next track id
+
+        return makeAtom("ftyp", ftyp)
+            + makeAtom("moov", makeAtom("mvhd", mvhd))
+            + makeAtom("mdat", std::string(options.audioBytes, '\0'));
+    }
+
+    // text that is exactly size bytes long
+    std::string filler(const std::string &prefix, std::size_t size, std::mt19937 &rng) {
+        static const std::string alphabet = "abcdefghijklmnopqrstuvwxyz ";
+        std::string result = prefix.substr(0, size);
+        while (result.size() < size) result += alphabet[rng() % alphabet.size()];
+        return result;
+    }
+}
+
+std::string CG::extensionOf(corpusFormat format) {
+    switch (format) {
+        case MP3: return ".mp3";
+        case FLAC: return ".flac";
+        case OGG: return ".ogg";
+        case M4A: return ".m4a";
+    }
+    return "";
+}
+
+CG::corpusFormat CG::parseFormat(const std::string &name) {
+    if (name == "mp3") return MP3;
+    if (name == "flac") return FLAC;
+    if (name == "ogg") return OGG;
+    if (name == "m4a") return M4A;
+    throw std::invalid_argument("unknown corpus format: " + name);
+}
+
+std::vector<std::string> CG::coverPaths(const CorpusOptions &options) {
+    std::vector<std::string> result;
+    for (std::size_t i = 0; i < options.pictures; i++) {
+        result.push_back((fs::path(options.dir) / "covers" / ("cover_" + std::to_string(i) + ".jpg")).string());
+    }
+    return result;
+}
+
+std::vector<std::string> CG::generateCorpus(const CorpusOptions &options) {
+    std::mt19937 rng (options.seed);
+    fs::create_directories(fs::path(options.dir) / "covers");
+
+    // covers are a JPEG SOI/APP0 marker followed by noise, which is all TagLib and the MIME sniffing look at
+    auto covers = coverPaths(options);
+    for (auto &cover : covers) {
+        std::ofstream out (cover, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+        std::string data = "\xFF\xD8\xFF\xE0" + randomBytes(rng, options.pictureBytes > 6 ? options.pictureBytes - 6 : 0) + "\xFF\xD9";
+        out.write(data.data(), data.size());
+    }
+
+    static const std::array<std::string, 6> genres = {"Jazz", "Rock", "Electronic", "Classical", "Hip-Hop", "Folk"};
+
+    std::vector<std::string> result;
+    for (auto format : options.formats) {
+        for (std::size_t i = 0; i < options.filesPerFormat; i++) {
+            std::string path = (fs::path(options.dir) / ("track_" + std::to_string(i) + extensionOf(format))).string();
+
+            std::string data;
+            switch (format) {
+                case MP3: data = makeMp3(options); break;
+                case FLAC: data = makeFlac(options); break;
+                case OGG: data = makeOgg(options); break;
+                case M4A: data = makeM4a(options); break;
+            }
+            {
+                std::ofstream out (path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+                out.write(data.data(), data.size());
+            }
+
+            // the tag text is spread over title, artist, album and comment
+            std::size_t part = options.tagBytes / 4;
+            TM::EditBatch batch;
+            batch.props = {
+                {TM::TITLE, filler("Track " + std::to_string(i) + " ", part, rng)},
+                {TM::ARTIST, filler("Artist " + std::to_string(i % 17) + " ", part, rng)},
+                {TM::ALBUM, filler("Album " + std::to_string(i / 12) + " ", part, rng)},
+                {TM::COMMENT, filler("", options.tagBytes - 3 * part, rng)},
+                {TM::GENRE, genres[i % genres.size()]},
+                {TM::YEAR, std::to_string(1970 + i % 50)},
+                {TM::TRACKNUMBER, std::to_string(i % 12 + 1)},
+            };
+            batch.replacePictures = true;
+            batch.pictures = covers;
+            // the tags don't fit into the generated padding, the rewrite should leave the same amount behind
+            batch.padding = options.padding;
+
+            TagLib::FileRef f (path.data());
+            if (f.isNull() || !TM::commitEdits(f, batch)) {
+                throw std::runtime_error("could not tag generated file " + path);
+            }
+
+            result.push_back(path);
+        }
+    }
+    return result;
+}
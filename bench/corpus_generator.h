@@ -0,0 +1,46 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace CG {
+    // container formats the generator can write
+    enum corpusFormat : int {
+        MP3,
+        FLAC,
+        OGG,
+        M4A
+    };
+
+    struct CorpusOptions {
+        // directory the corpus is written to, created if missing
+        std::string dir = "epictag_bench_corpus";
+        std::vector<corpusFormat> formats = {MP3, FLAC, OGG, M4A};
+        // files generated per format
+        std::size_t filesPerFormat = 50;
+        // approximate size of the text tags of each file, spread over the basic tags
+        std::size_t tagBytes = 256;
+        // pictures embedded into each file and the size of each of them
+        std::size_t pictures = 1;
+        std::size_t pictureBytes = 64 * 1024;
+        // padding reserved in front of the audio (MP3 ID3v2 and FLAC PADDING only, the other formats have none)
+        std::size_t padding = 4096;
+        // size of the dummy audio payload of each file
+        std::size_t audioBytes = 256 * 1024;
+        // the same seed always produces the same corpus
+        std::uint32_t seed = 1;
+    };
+
+    std::string extensionOf(corpusFormat format);
+
+    // parse a format name (mp3, flac, ogg, m4a), throws std::invalid_argument for anything else
+    corpusFormat parseFormat(const std::string& name);
+
+    // generate the corpus and return the paths of all audio files, in a stable order
+    // the files only contain enough structure for TagLib to accept them, the audio itself is silence/garbage
+    std::vector<std::string> generateCorpus(const CorpusOptions &options);
+
+    // paths of the cover images written next to the corpus, used for the embedding benchmark
+    std::vector<std::string> coverPaths(const CorpusOptions &options);
+}
@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "corpus_generator.h"
+#include "../src/fast_reader.h"
+#include "../src/file_handler.h"
+#include "../src/tag_manager.h"
+#include "../src/tag_record.h"
+
+#include "argparse/argparse.hpp"
+
+namespace fs = std::filesystem;
+
+namespace {
+    using benchClock = std::chrono::steady_clock;
+
+    // left in every corpus directory, only directories with it are ever generated into or cleaned up
+    const std::string corpusMarker = ".epictag_bench_corpus";
+    // a single walk of the corpus is too short for a latency distribution
+    constexpr std::size_t gatherRuns = 20;
+
+    struct IoCounters {
+        std::uint64_t read = 0;
+        std::uint64_t written = 0;
+    };
+
+    // bytes passed through read/write syscalls of this process so far (Linux only, zero elsewhere)
+    IoCounters currentIo() {
+        IoCounters result;
+        std::ifstream io ("/proc/self/io");
+        std::string key;
+        std::uint64_t value;
+        while (io >> key >> value) {
+            if (key == "rchar:") result.read = value;
+            if (key == "wchar:") result.written = value;
+        }
+        return result;
+    }
+
+    struct OpResult {
+        std::string name;
+        std::vector<double> latenciesMs;
+        double totalSeconds = 0;
+        IoCounters io;
+    };
+
+    double percentile(std::vector<double> values, double p) {
+        if (values.empty()) return 0;
+        std::ranges::sort(values);
+        auto idx = std::min(values.size() - 1, static_cast<std::size_t>(values.size() * p));
+        return values[idx];
+    }
+
+    // time fn once per item, every call is one sample of the latency distribution
+    OpResult timeOp(const std::string& name, const std::vector<std::string>& items, const std::function<void(const std::string&)>& fn) {
+        OpResult result;
+        result.name = name;
+
+        IoCounters before = currentIo();
+        auto start = benchClock::now();
+        for (auto& item : items) {
+            auto opStart = benchClock::now();
+            fn(item);
+            result.latenciesMs.push_back(std::chrono::duration<double, std::milli>(benchClock::now() - opStart).count());
+        }
+        result.totalSeconds = std::chrono::duration<double>(benchClock::now() - start).count();
+        IoCounters after = currentIo();
+
+        result.io = {after.read - before.read, after.written - before.written};
+        return result;
+    }
+
+    void printResults(const std::vector<OpResult>& results) {
+        std::cout << std::left << std::setw(16) << "operation"
+                  << std::right << std::setw(8) << "ops"
+                  << std::setw(12) << "ops/sec"
+                  << std::setw(12) << "MB read"
+                  << std::setw(12) << "MB written"
+                  << std::setw(12) << "p50 ms"
+                  << std::setw(12) << "p99 ms" << "\n";
+
+        for (auto& result : results) {
+            double opsPerSec = result.totalSeconds > 0 ? result.latenciesMs.size() / result.totalSeconds : 0;
+            std::cout << std::left << std::setw(16) << result.name
+                      << std::right << std::setw(8) << result.latenciesMs.size()
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(12) << opsPerSec
+                      << std::setprecision(2)
+                      << std::setw(12) << result.io.read / 1e6
+                      << std::setw(12) << result.io.written / 1e6
+                      << std::setprecision(3)
+                      << std::setw(12) << percentile(result.latenciesMs, 0.5)
+                      << std::setw(12) << percentile(result.latenciesMs, 0.99) << "\n";
+        }
+    }
+}
+
+int main(int argc, char* argv[]) {
+    argparse::ArgumentParser app ("epictag_bench");
+    app.add_description("Generates a reproducible corpus of tagged audio files and times the epictagmanager code paths on it");
+
+    app.add_argument("--dir")
+    .default_value(std::string("epictag_bench_corpus"))
+    .help("Directory the corpus is generated in, has to be new, empty or a corpus of an earlier run");
+
+    app.add_argument("--formats")
+    .nargs(argparse::nargs_pattern::at_least_one)
+    .default_value(std::vector<std::string>{"mp3", "flac", "ogg", "m4a"})
+    .help("Formats to generate: mp3, flac, ogg, m4a");
+
+    app.add_argument("--files")
+    .default_value(std::size_t {50})
+    .scan<'u', std::size_t>()
+    .help("Files generated per format");
+
+    app.add_argument("--tag-bytes")
+    .default_value(std::size_t {256})
+    .scan<'u', std::size_t>()
+    .help("Approximate size of the text tags of each file");
+
+    app.add_argument("--pictures")
+    .default_value(std::size_t {1})
+    .scan<'u', std::size_t>()
+    .help("Pictures embedded into each file");
+
+    app.add_argument("--picture-bytes")
+    .default_value(std::size_t {64 * 1024})
+    .scan<'u', std::size_t>()
+    .help("Size of each embedded picture");
+
+    app.add_argument("--padding")
+    .default_value(std::size_t {4096})
+    .scan<'u', std::size_t>()
+    .help("Tag padding reserved in generated MP3 and FLAC files");
+
+    app.add_argument("--seed")
+    .default_value(std::uint32_t {1})
+    .scan<'u', std::uint32_t>()
+    .help("Seed of the corpus generator, the same seed always gives the same corpus");
+
+    app.add_argument("--keep")
+    .flag()
+    .help("Keep the corpus directory after the run");
+
+    try {
+        app.parse_args(argc, argv);
+    } catch (const std::runtime_error& err) {
+        std::cerr << err.what() << "\n";
+        std::cout << app;
+        return 1;
+    }
+
+    CG::CorpusOptions options;
+    options.dir = app.get<std::string>("--dir");
+    options.formats.clear();
+    try {
+        for (auto& name : app.get<std::vector<std::string>>("--formats")) {
+            options.formats.push_back(CG::parseFormat(name));
+        }
+    } catch (const std::invalid_argument& err) {
+        std::cerr << err.what() << "\n";
+        return 1;
+    }
+    options.filesPerFormat = app.get<std::size_t>("--files");
+    options.tagBytes = app.get<std::size_t>("--tag-bytes");
+    options.pictures = app.get<std::size_t>("--pictures");
+    options.pictureBytes = app.get<std::size_t>("--picture-bytes");
+    options.padding = app.get<std::size_t>("--padding");
+    options.seed = app.get<std::uint32_t>("--seed");
+
+    // anything else in there would be walked by the bench and deleted after it
+    fs::path marker = fs::path(options.dir) / corpusMarker;
+    std::error_code dirEc;
+    if (fs::exists(options.dir, dirEc) && !fs::is_empty(options.dir, dirEc) && !fs::exists(marker, dirEc)) {
+        std::cerr << options.dir << " is not empty and not a corpus of an earlier run, use a new directory" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Generating corpus in " << options.dir << std::endl;
+    std::vector<std::string> files;
+    try {
+        fs::create_directories(options.dir);
+        std::ofstream(marker).flush();
+        files = CG::generateCorpus(options);
+    } catch (const std::exception& e) {
+        std::cerr << "Exception while generating the corpus: " << e.what() << std::endl;
+        return 1;
+    }
+    auto covers = CG::coverPaths(options);
+    std::cout << files.size() << " files generated" << std::endl << std::endl;
+
+    std::vector<OpResult> results;
+
+    results.push_back(timeOp("gather", std::vector<std::string>(gatherRuns, options.dir), [](const std::string& dir) {
+        FH::gatherAllFilesFromList({dir}, true);
+    }));
+
+    results.push_back(timeOp("readProps", files, [](const std::string& file) {
+        TagLib::FileRef f (file.data());
+        TM::readProps(f, TM::findAllDefinedProps(f));
+    }));
+
+    // the read mode path: header-only parsing, falling back to a tags-only FileRef
+    results.push_back(timeOp("readTagProps", files, [](const std::string& file) {
+        auto propMap = FR::readTagProps(file);
+        if (!propMap) {
+            TagLib::FileRef f (file.data(), false);
+            propMap = f.properties();
+        }
+        TM::readAllProps(*propMap);
+    }));
+
+    // the same, but kept as interned records the way the server holds a whole library
+    std::vector<TR::TagRecord> records;
+    records.reserve(files.size());
+    results.push_back(timeOp("readTagRecord", files, [&records](const std::string& file) {
+        auto propMap = FR::readTagProps(file);
+        if (!propMap) {
+            TagLib::FileRef f (file.data(), false);
+            propMap = f.properties();
+        }
+        records.emplace_back(*propMap);
+    }));
+
+    std::size_t writeCount = 0;
+    results.push_back(timeOp("writeProps", files, [&writeCount](const std::string& file) {
+        TagLib::FileRef f (file.data());
+        // a value that differs from the generated one, so every file really gets written
+        TM::EditBatch batch;
+        batch.props = {{TM::TITLE, "Bench title " + std::to_string(writeCount++)}};
+        TM::commitEdits(f, batch);
+    }));
+
+    // appends one more cover to every file, so it's a real change even though the generator already embedded the covers
+    if (!covers.empty()) {
+        results.push_back(timeOp("addImgTag", files, [&covers](const std::string& file) {
+            TagLib::FileRef f (file.data());
+            TM::addImgTag(f, covers.front());
+            TM::saveFile(f);
+        }));
+    }
+
+    results.push_back(timeOp("extractImgTags", files, [](const std::string& file) {
+        TagLib::FileRef f (file.data());
+        TM::extractImgTags(f);
+    }));
+
+    printResults(results);
+    std::cout << std::endl << records.size() << " records share " << TR::internedCount() << " interned value lists (" << TR::internedBytes() / 1024 << " KiB)" << std::endl;
+
+    if (!app.get<bool>("--keep")) {
+        // only what the generator wrote, the directories go only if that leaves them empty
+        std::error_code ec;
+        for (auto& file : files) {
+            // extractImgTags left its pictures next to every file, named like the extract mode names them
+            for (int imgIdx = 0; ; imgIdx++) {
+                bool removedJpg = fs::remove(TM::imgExportName(file, imgIdx, "image/jpeg"), ec);
+                bool removedPng = fs::remove(TM::imgExportName(file, imgIdx, "image/png"), ec);
+                if (!removedJpg && !removedPng) break;
+            }
+            fs::remove(file, ec);
+        }
+        for (auto& cover : covers) fs::remove(cover, ec);
+        fs::remove(fs::path(options.dir) / "covers", ec);
+        fs::remove(marker, ec);
+        fs::remove(options.dir, ec);
+    }
+
+    return 0;
+}
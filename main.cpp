@@ -1,7 +1,30 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <unistd.h>
 
 #include "src/tag_manager.h"
+#include "src/dir_walker.h"
+#include "src/manifest.h"
 #include "src/file_handler.h"
+#include "src/image_store.h"
+#include "src/interactive.h"
+#include "src/journal.h"
+#include "src/output_writer.h"
+#include "src/query.h"
+#include "src/picture_extractor.h"
+#include "src/prefetcher.h"
+#include "src/stats.h"
+#include "src/sync.h"
+#include "src/tag_layout.h"
+#include "src/tag_server.h"
+#include "src/session.h"
+#include "src/tag_index.h"
+#include "src/work_pool.h"
 
 #include "argparse/argparse.hpp"
 
@@ -25,15 +48,127 @@ int main(int argc, char* argv[]) {
     .help("Use read mode: Read all provided tags from input files");
     rwModeGroup.add_argument("-w", "--write").flag()
     .help("Use write mode: Write all provided tags to the input files, replacing any previous values");
+    rwModeGroup.add_argument("--apply")
+    .help("Use apply mode: Write the tags and pictures listed per file in a CSV, TSV (as written by --format tsv) or NDJSON manifest, input files are taken from the manifest")
+    .metavar("MANIFEST");
+    rwModeGroup.add_argument("--sync")
+    .nargs(2)
+    .help("Use sync mode: Copy the tags of every file in SOURCE to the file with the same relative path (any extension) in TARGET, only saving targets that differ. Without -T keys every tag and the pictures are synced")
+    .metavar("SOURCE TARGET");
+    rwModeGroup.add_argument("--interactive").flag()
+    .help("Use interactive mode: Open files once and read, edit and commit them with commands, also started when there are no arguments. Input files are opened right away");
+    rwModeGroup.add_argument("--serve")
+    .help("Use serve mode: Keep the tags of all input files in memory and answer reads and writes on a unix socket, watched directories are re-indexed as files change")
+    .metavar("SOCKET");
+
+    // filtering what is picked up from input directories
+    app.add_argument("--include")
+    .nargs(argparse::nargs_pattern::at_least_one)
+    .help("Only use files from input directories matching one of these glob patterns, e.g. \"*.flac\"")
+    .metavar("GLOBS");
+
+    app.add_argument("--exclude")
+    .nargs(argparse::nargs_pattern::at_least_one)
+    .help("Skip files and subdirectories of input directories matching one of these glob patterns")
+    .metavar("GLOBS");
+
+    app.add_argument("--follow-symlinks")
+    .flag()
+    .help("Also walk symlinked directories inside input directories, each directory is still only walked once");
 
     app.add_argument("-v","--verbose")
     .flag()
     .help("Output extra information about what the app is doing");
 
+    app.add_argument("--dry-run")
+    .flag()
+    .help("Write and apply mode only print what would change in each file, nothing is saved");
+
+    app.add_argument("--padding")
+    .default_value(std::string("4K"))
+    .help("Tag padding to leave when a file has to be rewritten anyway, so later edits can be saved in place, e.g. 64K. TagLib keeps at most 1% of the file size (up to 1M)")
+    .metavar("SIZE");
+
     app.add_argument("--all")
     .flag()
     .help("Flag that modifies mode behaviour - makes read mode read all tags the input files have, makes write mode write to all provided files instead of the first one");
 
+    app.add_argument("-j","--jobs")
+    .default_value(1u)
+    .scan<'u', unsigned int>()
+    .help("Number of files processed at the same time, 0 uses one job per CPU thread. Output stays in input order")
+    .metavar("N");
+
+    app.add_argument("--prefetch")
+    .default_value(std::size_t {0})
+    .scan<'u', std::size_t>()
+    .help("Start reading the tag regions of the next N input files in the background while the current ones are processed. Helps on cold disks and network storage, 0 turns it off")
+    .metavar("N");
+
+    app.add_argument("--format")
+    .default_value(std::string("text"))
+    .choices("text", "ndjson", "tsv")
+    .help("Output format of read mode: text for people, ndjson or tsv (one record per file) for scripts")
+    .metavar("FORMAT");
+
+    app.add_argument("--where")
+    .nargs(argparse::nargs_pattern::at_least_one)
+    .help("Read mode only outputs files matching all of these conditions: KEY=VALUE, KEY!=VALUE, KEY^=PREFIX, KEY~=REGEX, KEY<N, KEY<=N, KEY>N, KEY>=N. KEY= matches files without the tag, KEY!= files with it, e.g. --where GENRE=Jazz DATE=")
+    .metavar("CONDITIONS");
+
+    app.add_argument("--select")
+    .nargs(argparse::nargs_pattern::at_least_one)
+    .help("Tags read mode outputs, the same as -T KEY for each of them. Only these and the ones --where needs are read")
+    .metavar("KEYS");
+
+    app.add_argument("--stats")
+    .flag()
+    .help("Print counters and per-phase timings (walk, sniff, parse, save, image I/O, output) to stderr when done");
+
+    app.add_argument("--stats-json")
+    .flag()
+    .help("Same as --stats, but as a single JSON object");
+
+    app.add_argument("--index")
+    .help("Keep a tag index at PATH. Read mode answers files that haven't changed since they were indexed without opening them, write mode updates the index")
+    .metavar("PATH");
+
+    // splitting huge runs over several machines and surviving restarts
+    app.add_argument("--shard")
+    .help("Only handle part I of N of the input files (1 <= I <= N), split by a hash of each path. Every machine running the same command with its own I gets a different part")
+    .metavar("I/N");
+
+    app.add_argument("--journal")
+    .help("Append every file write, apply or sync mode has completely handled to the journal at PATH, in fsync-ed batches. Saved files are flushed to disk before they are listed, read mode leaves the journal alone")
+    .metavar("PATH");
+
+    app.add_argument("--resume")
+    .flag()
+    .help("Skip the files already listed in --journal without opening them, instead of starting the journal over");
+
+    app.add_argument("--cache-size")
+    .default_value(std::size_t {64})
+    .scan<'u', std::size_t>()
+    .help("Files interactive mode keeps parsed in memory, files with uncommitted edits are always kept")
+    .metavar("N");
+
+    app.add_argument("--sync-state")
+    .help("Where sync mode keeps the size and mtime of each synced pair, pairs where neither file changed are skipped without opening them. Defaults to .epictag-sync in TARGET")
+    .metavar("PATH");
+
+    // bulk picture extraction, only used with -p in read mode
+    app.add_argument("--extract-dir")
+    .help("Extract pictures into DIR instead of next to each file. Identical pictures are only written once, named by their content hash")
+    .metavar("DIR");
+
+    app.add_argument("--manifest")
+    .help("Where --extract-dir records which pictures belong to which file, defaults to DIR/manifest.ndjson")
+    .metavar("PATH");
+
+    app.add_argument("--hardlink")
+    .flag()
+    .help("With --extract-dir, also create the usual per-file picture names next to each file as hardlinks to the extracted pictures");
+
     // map out all common tags
     std::map<std::vector<std::string>, int> basicTags = {
         {{"-a","--artist"},ARTIST},
@@ -50,7 +185,7 @@ int main(int argc, char* argv[]) {
     basicTagGroup.add_description("Read the passed tags when in read mode, writes the passed values in write mode");
 
     for (auto& [aliases, tag] : basicTags) {
-        std::string helpMsg = "Use the " + propKeys[tag] + " tag";
+        std::string helpMsg = "Use the " + std::string(propKeys[tag]) + " tag";
 
         if (aliases.size() == 2) {
             // if tag has both a short and long alias defined
@@ -61,6 +196,12 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // every other property TagLib maps (ALBUMARTIST, ISRC, REPLAYGAIN_* ...) only gets this generic option
+    basicTagGroup.add_argument("-T","--tag")
+    .nargs(argparse::nargs_pattern::at_least_one)
+    .help("Use any TagLib property by its key. Pass KEY in read mode and KEY=VALUE in write mode, e.g. -T ALBUMARTIST=Someone")
+    .metavar("KEYS");
+
     // for providing img path and reading/extracting
     app.add_argument("-p","--picture")
     .nargs(argparse::nargs_pattern::any)
@@ -79,21 +220,24 @@ int main(int argc, char* argv[]) {
 
     // process passed arguments
     if (argc == 1) {
-        // no arguments passed, print help info
-        std::cout << app << std::endl;
-        // can be used to launch some sort of interactive mode in the future
+        // no arguments passed, start interactive mode with the default options
+        std::cout << "Interactive mode, type help for commands. Run with --help for the command line options" << std::endl;
+        IM::Shell shell;
+        shell.run(std::cin, std::cout, isatty(STDIN_FILENO));
     } else {
         // arg mode
         // process all input file paths
-        std::vector<std::string> inputFiles;
+        std::vector<std::string> inputPaths;
 
-        try {
-            inputFiles = FH::gatherAllFilesFromList(
-                app.get<std::vector<std::string>>("--input"),
-                true
-            );
-        } catch (const std::exception &e) {
-            std::cerr << "Exception while parsing input files: " << e.what() << std::endl;
+        // apply mode takes its files from the manifest instead, sync mode from its two directories
+        // interactive mode opens files on its own, input files are optional there
+        bool interactive = app["--interactive"] == true;
+        if (!app.is_used("--apply") && !app.is_used("--sync") && !(interactive && !app.is_used("--input"))) {
+            try {
+                inputPaths = app.get<std::vector<std::string>>("--input");
+            } catch (const std::exception &e) {
+                std::cerr << "Exception while parsing input files: " << e.what() << std::endl;
+            }
         }
 
         // loop through the defined basic tag aliases and check if each of them was used
@@ -110,94 +254,465 @@ int main(int argc, char* argv[]) {
             }
         }
 
+        if (app.is_used("--tag")) {
+            for (auto& entry : app.get<std::vector<std::string>>("--tag")) {
+                // KEY or KEY=VALUE, keys are matched case-insensitively
+                auto separator = entry.find('=');
+                std::string key = entry.substr(0, separator);
+                std::ranges::transform(key, key.begin(), [](unsigned char c) { return std::toupper(c); });
+
+                int type = findPropTypeByKey(key);
+                if (type == UNDEFINED) {
+                    std::cerr << "WARN: Unknown tag key " << key << " will be ignored" << std::endl;
+                    continue;
+                }
+
+                requestedProps.insert(type);
+                providedVals.insert_or_assign(type, separator == std::string::npos ? "" : entry.substr(separator + 1));
+            }
+        }
+
+        if (app.is_used("--select")) {
+            for (auto key : app.get<std::vector<std::string>>("--select")) {
+                std::ranges::transform(key, key.begin(), [](unsigned char c) { return std::toupper(c); });
+                int type = findPropTypeByKey(key);
+                if (type == UNDEFINED) {
+                    std::cerr << "WARN: Unknown tag key " << key << " will be ignored" << std::endl;
+                    continue;
+                }
+                requestedProps.insert(type);
+            }
+        }
+
+        QY::Query query;
+        if (app.is_used("--where")) {
+            try {
+                query = QY::parseQuery(app.get<std::vector<std::string>>("--where"));
+            } catch (const std::invalid_argument &e) {
+                std::cerr << e.what() << std::endl;
+                return 1;
+            }
+        }
+
+        bool statsText = app["--stats"] == true;
+        bool statsJson = app["--stats-json"] == true;
+        // nothing is measured (not even the clock read) unless it was asked for
+        if (statsText || statsJson) ST::enable();
+
+        bool verbose = app["--verbose"] == true;
+        bool allFlag = app["--all"] == true;
+        bool dryRun = app["--dry-run"] == true;
+
+        std::uint64_t padding = 0;
+        if (auto parsed = TL::parseSize(app.get<std::string>("--padding"))) {
+            padding = *parsed;
+        } else {
+            std::cerr << "Invalid --padding size " << app.get<std::string>("--padding") << std::endl;
+            return 1;
+        }
+        bool pictureUsed = app.is_used("-p");
+        unsigned int jobs = WP::resolveJobCount(app.get<unsigned int>("--jobs"));
+
+        // all reads and writes go through the session, which also keeps the optional persistent index
+        // of all defined properties of each file
+        ES::SessionOptions sessionOptions;
+        sessionOptions.jobs = jobs;
+        sessionOptions.indexPath = app.present("--index").value_or("");
+        ES::Session session (sessionOptions);
+        TI::TagIndex *index = session.index();
+
+        std::optional<JR::Shard> shard;
+        if (auto shardValue = app.present("--shard")) {
+            shard = JR::parseShard(*shardValue);
+            if (!shard) {
+                std::cerr << "Invalid --shard " << *shardValue << ", expected I/N with 1 <= I <= N" << std::endl;
+                return 1;
+            }
+        }
+
+        // a dry run doesn't complete anything and read mode never records anything, both leave the journal alone
+        bool resume = app["--resume"] == true;
+        bool journaled = !dryRun && (app["-w"] == true || app.is_used("--apply") || app.is_used("--sync"));
+        std::unique_ptr<JR::Journal> journal;
+        if (auto journalPath = app.present("--journal"); journalPath && journaled) {
+            journal = std::make_unique<JR::Journal>(*journalPath, resume);
+            if (!journal->isOpen()) return 1;
+        } else if (resume && !journalPath) {
+            std::cerr << "--resume needs a --journal to resume from" << std::endl;
+            return 1;
+        }
+
+        // files of other shards and files completed by an earlier run are dropped before they're even opened
+        std::size_t skippedCount = 0;
+        auto wantedFile = [&shard, &journal, &skippedCount](const std::string& file) {
+            if (shard && !JR::inShard(file, *shard)) return false;
+            if (journal && journal->contains(file)) {
+                skippedCount++;
+                return false;
+            }
+            return true;
+        };
+
+        // input directories are walked in the background and files are processed as soon as they are found
+        DW::WalkOptions walkOptions;
+        walkOptions.include = app.present<std::vector<std::string>>("--include").value_or(std::vector<std::string>{});
+        walkOptions.exclude = app.present<std::vector<std::string>>("--exclude").value_or(std::vector<std::string>{});
+        walkOptions.followSymlinks = app["--follow-symlinks"] == true;
+        walkOptions.threads = jobs;
+        // remove any files not supported by TagLib before they're even queued
+        // only the extension and a small header read are checked, the file gets parsed once in the processing loop
+        // reads through the index go by the extension alone, unchanged files are then answered without touching them
+        // at all and the ones that have to be parsed are still checked by TagLib
+        bool indexedRead = index && app["-r"] == true && !pictureUsed;
+        walkOptions.accept = [indexedRead](const std::string& path) {
+            if (indexedRead && FH::hasAudioExtension(path)) return true;
+            if (!FH::isSupportedAudio(path)) {
+                std::cerr << "WARN: Unsupported file provided as input: " << FH::getFilenameOf(path) << std::endl;
+                return false;
+            }
+            return true;
+        };
+
+        // serve mode walks and watches the input itself, sync and interactive mode walk their own directories
+        bool ownWalk = app.is_used("--serve") || app.is_used("--sync") || interactive;
+        DW::DirWalker walker (ownWalk ? std::vector<std::string>{} : inputPaths, walkOptions);
+        auto nextWalkedFile = [&walker, &wantedFile](std::string& file) {
+            while (walker.next(file)) {
+                if (wantedFile(file)) return true;
+            }
+            return false;
+        };
+
+        // files are handed to the processing loop through the prefetcher, which reads ahead in the list
+        std::unique_ptr<PF::Prefetcher> prefetcher;
+        if (std::size_t depth = app.get<std::size_t>("--prefetch")) {
+            PF::PrefetchOptions prefetchOptions;
+            prefetchOptions.depth = depth;
+            prefetcher = std::make_unique<PF::Prefetcher>(nextWalkedFile, prefetchOptions);
+        }
+        auto nextInputFile = [&nextWalkedFile, &prefetcher](std::string& file) {
+            return prefetcher ? prefetcher->next(file) : nextWalkedFile(file);
+        };
+
         if (app["-r"] == true) {
             // read all requested tags
-            for (auto& file : inputFiles) {
-                // make a fileref out of each file to read the properties
-                // the fileref constructor doesn't take std::string directly, only char*, so .data is used
-                TagLib::FileRef f (file.data());
+            // machine readable formats go through a large buffer straight to stdout instead of being flushed per line
+            OW::outputFormat format = OW::parseFormat(app.get<std::string>("--format"));
+            std::unique_ptr<OW::BufferedOutput> bufferedOut;
+            if (format != OW::TEXT) bufferedOut = std::make_unique<OW::BufferedOutput>(STDOUT_FILENO);
+            std::ostream& resultOut = bufferedOut ? *bufferedOut : std::cout;
 
-                if (app["--all"] == true) {
-                    std::cout << "All defined properties of file: " << FH::getFilenameOf(file) << std::endl;
-                    printProps(
-                        readProps(f, findAllDefinedProps(f))
-                    );
-                } else {
-                    std::cout << "Properties of file: " << FH::getFilenameOf(file) << std::endl;
-                    printProps(
-                        readProps(f, requestedProps)
-                    );
+            // TSV needs fixed columns, --all uses every known tag
+            std::vector<int> tsvColumns;
+            if (allFlag) {
+                for (int type = ALBUM; type < PROP_COUNT; type++) tsvColumns.push_back(type);
+            } else {
+                tsvColumns = OW::sortedColumns(requestedProps);
+            }
+            if (format == OW::TSV) OW::writeTsvHeader(resultOut, tsvColumns);
+
+            // with an extract directory every picture is only written once, no matter how many files embed it
+            std::unique_ptr<PE::PictureExtractor> extractor;
+            if (auto extractDir = app.present("--extract-dir"); extractDir && pictureUsed) {
+                extractor = std::make_unique<PE::PictureExtractor>(
+                    *extractDir,
+                    app.present("--manifest").value_or(""),
+                    app["--hardlink"] == true
+                );
+            }
+
+            // the tags --where looks at are read too, but only the requested ones are output
+            std::unordered_set<int> neededProps = requestedProps;
+            neededProps.merge(query.types());
+            std::atomic<std::size_t> matchCount = 0;
+
+            // every file is handled on the worker pool, the output of each file is kept together and in input order
+            std::size_t fileCount = WP::forEachOrdered(nextInputFile, jobs, resultOut, [&](const std::string& file, std::ostream& out) {
+                auto printFileProps = [&](const std::map<int, TagLib::StringList>& props) {
+                    if (format != OW::TEXT) {
+                        OW::writeRecord(out, format, file, props, tsvColumns);
+                        return;
+                    }
+
+                    if (allFlag) {
+                        out << "All defined properties of file: " << FH::getFilenameOf(file) << std::endl;
+                    } else {
+                        out << "Properties of file: " << FH::getFilenameOf(file) << std::endl;
+                    }
+                    printProps(props, out);
+                };
+
+                // extracting pictures needs the file opened through TagLib, otherwise the index and the fast tag reader are used
+                ES::ReadResult result = session.readFile(file, allFlag ? nullptr : &neededProps, pictureUsed);
+                if (!result.ok) {
+                    std::cerr << "WARN: Unsupported file provided as input: " << FH::getFilenameOf(file) << std::endl;
+                    return;
                 }
 
+                if (!QY::matches(query, result.props)) return;
+                matchCount++;
+                // the session already left out everything but the needed tags, only the ones --where added have to go
+                printFileProps(allFlag || query.empty() ? result.props : selectProps(result.props, requestedProps));
+
                 // extracting images is a heavier operation so it should probably not be included in --all
-                if (app.is_used("-p")) {
-                    bool success = extractImgTags(f);
-                    if (app["--verbose"] == true && success) {
-                        std::cout << "Successfully extracted all picture data of " << file;
+                if (pictureUsed) {
+                    bool success = extractor ? extractor->extract(*result.file, file) : extractImgTags(*result.file);
+                    if (verbose && success && format == OW::TEXT) {
+                        out << "Successfully extracted all picture data of " << file;
                     }
                 }
 
-                std::cout << std::endl;
+                if (format == OW::TEXT) out << std::endl;
+            });
+
+            resultOut.flush();
+
+            if (verbose && !query.empty()) {
+                std::cerr << "Files matching --where: " << matchCount << " of " << fileCount << std::endl;
+            }
+
+            if (extractor) {
+                extractor->finish();
+                if (verbose) {
+                    std::cerr << "Pictures extracted: " << extractor->uniqueCount() << " unique out of " << extractor->pictureCount() << std::endl;
+                }
             }
         } else if (app["-w"] == true) {
             // writing all passed tags
             // for safety it will only write to the first provided file unless --all is specified
-            if (app["--verbose"] == true) {
-                if (app["--all"] == true) {
+            std::vector<std::string> firstFile;
+            if (!allFlag) {
+                // stop writing data after the first file if --all has not been used
+                // the walk order is fixed (see DW::DirWalker), so it's the same file on every run
+                if (std::string file; nextWalkedFile(file)) firstFile.push_back(file);
+                walker.stop();
+            }
+
+            if (verbose) {
+                if (allFlag) {
                     std::cout << "Writing provided tags to ALL input files";
-                } else {
-                    std::cout << "Writing provided tags to first input file - " << inputFiles[0];
+                } else if (!firstFile.empty()) {
+                    std::cout << "Writing provided tags to first input file - " << firstFile[0];
                 }
                 std::cout << std::endl;
             }
 
             // get all provided images if there are any
-            // since the images stay the same, there's no need to re-read them for every input audio
+            // the images themselves are only read once by the image store and shared between all input audio
             std::vector<std::string> imgList;
-            if (app.is_used("-p")) {
+            if (pictureUsed) {
                 imgList = FH::gatherAllFilesFromList(
                     app.get<std::vector<std::string>>("--picture"),
                     false
                 );
             }
 
-            for (auto& file : inputFiles) {
-                std::cout << "Writing properties to " << FH::getFilenameOf(file) << std::endl;
+            auto writeFile = [&](const std::string& file, std::ostream& out) {
+                out << "Writing properties to " << FH::getFilenameOf(file) << std::endl;
 
-                TagLib::FileRef f (file.data());
-                writeProps(f, providedVals);
+                // collect every text and picture change so the file only gets saved once
+                EditBatch batch;
+                batch.props = providedVals;
+                // picture tag used, existing picture data gets replaced by the provided images
+                batch.replacePictures = pictureUsed;
+                batch.pictures = imgList;
+                batch.padding = padding;
 
-                if (app["--verbose"] == true) {
-                    std::cout << "Properties of file: " << FH::getFilenameOf(file) << std::endl;
+                // files that already have every requested value are only read, not saved again
+                ES::WriteResult result = session.writeFile(file, batch, dryRun);
+                if (!result.opened) {
+                    std::cerr << "WARN: Unsupported file provided as input: " << FH::getFilenameOf(file) << std::endl;
+                    return;
+                }
+                const EditDiff& diff = result.diff;
+                if (dryRun) {
+                    out << "Changes to " << file << ":" << std::endl;
+                    printDiff(diff, out);
+                    if (!diff.empty()) out << "Save: " << commitResultName(result.result) << std::endl;
+                    out << std::endl;
+                    return;
+                }
+
+                if (!result.result) {
+                    std::cerr << "Could not save changes to " << FH::getFilenameOf(file) << std::endl;
+                } else if (result.result != COMMIT_UNCHANGED) {
+                    out << "Saved " << FH::getFilenameOf(file) << ": " << commitResultName(result.result) << std::endl;
+                }
+                // failed files stay out of the journal, so a resumed run tries them again
+                if (result.result && journal && (result.result == COMMIT_UNCHANGED || JR::syncFile(file))) journal->record(file);
+
+                if (verbose && diff.empty()) {
+                    out << "Already up to date: " << FH::getFilenameOf(file) << std::endl << std::endl;
+                } else if (verbose) {
+                    out << "Properties of file: " << FH::getFilenameOf(file) << std::endl;
                     printProps(
-                        readProps(f, requestedProps)
+                        selectProps(result.props, requestedProps),
+                        out
                     );
-                    std::cout << std::endl;
+                    out << std::endl;
+
+                    if (pictureUsed && imgList.empty()) {
+                        out << "All picture data removed from " << FH::getFilenameOf(file) << std::endl << std::endl;
+                    }
+                    for (auto& imgPath : imgList) {
+                        out << "Cover image " << FH::getFilenameOf(imgPath) << " added to " << FH::getFilenameOf(file) << std::endl << std::endl;
+                    }
                 }
+            };
 
-                // picture tag used
-                if (app.is_used("-p")) {
-                    // reset file image data
-                    f.setComplexProperties("PICTURE",{});
+            std::size_t fileCount = allFlag
+                ? WP::forEachOrdered(nextInputFile, jobs, std::cout, writeFile)
+                : WP::forEachOrdered(firstFile, jobs, std::cout, writeFile);
 
-                    if (imgList.empty()) {
-                        if (app["-v"] == true) std::cout << "All picture data removed from " << FH::getFilenameOf(file) << std::endl << std::endl;
-                        f.save();
-                    }
+            if (verbose) {
+                std::cout << "Saves performed: " << saveCount() << " for " << fileCount << " files, " << unchangedCount() << " already up to date" << std::endl;
+                std::cout << "Images read from disk: " << IS::readCount() << std::endl;
+            }
+        } else if (auto manifestPath = app.present("--apply")) {
+            // every file gets its own values from the manifest, all of them in this one process
+            // the manifest is read while the files are being written, it never has to fit in memory
+            MF::ManifestReader manifest (*manifestPath);
+            if (!manifest.isOpen()) {
+                std::cerr << "Could not open manifest " << *manifestPath << std::endl;
+                return 1;
+            }
 
-                    // loop over every image and add them to the input one by one
-                    for (auto& imgPath : imgList) {
-                        addImgTag(f, imgPath);
-                        if (app["-v"] == true) std::cout << "Cover image " << FH::getFilenameOf(imgPath) << " added to " << FH::getFilenameOf(file) << std::endl << std::endl;
+            auto applyEntry = [&](const MF::Entry& entry, std::ostream& out) {
+                // covers shared by many entries are only read once, the image store keeps them
+                ES::WriteResult result = session.writeFile(entry.path, entry.batch, dryRun);
+                if (!result.opened) {
+                    std::cerr << "WARN: Unsupported file on manifest line " << entry.line << ": " << entry.path << std::endl;
+                    return;
+                }
+
+                if (dryRun) {
+                    out << "Changes to " << entry.path << " (manifest line " << entry.line << "):" << std::endl;
+                    printDiff(result.diff, out);
+                    if (!result.diff.empty()) out << "Save: " << commitResultName(result.result) << std::endl;
+                    out << std::endl;
+                    return;
+                }
+
+                if (!result.result) {
+                    std::cerr << "Could not save changes to " << FH::getFilenameOf(entry.path) << std::endl;
+                    return;
+                }
+                if (journal && (result.result == COMMIT_UNCHANGED || JR::syncFile(entry.path))) journal->record(entry.path);
+
+                if (verbose) {
+                    out << "Applied manifest line " << entry.line << " to " << entry.path << ": " << commitResultName(result.result) << std::endl;
+                }
+            };
+
+            std::size_t fileCount = WP::forEachOrdered<MF::Entry>(
+                [&](MF::Entry& entry) {
+                    while (manifest.next(entry)) {
+                        if (!wantedFile(entry.path)) continue;
+                        entry.batch.padding = padding;
+                        return true;
                     }
+                    return false;
+                },
+                jobs, std::cout, applyEntry
+            );
+
+            if (verbose) {
+                std::cout << "Saves performed: " << saveCount() << " for " << fileCount << " files, " << unchangedCount() << " already up to date" << std::endl;
+                std::cout << "Images read from disk: " << IS::readCount() << std::endl;
+            }
+        } else if (app.is_used("--sync")) {
+            auto dirs = app.get<std::vector<std::string>>("--sync");
+            for (auto& dir : dirs) {
+                if (!FH::pathIsDir(dir)) {
+                    std::cerr << "Sync needs two directories, " << dir << " is not one" << std::endl;
+                    return 1;
                 }
+            }
 
-                // stop writing data after the first file if --all has not been used
-                if (app["--all"] != true) {
-                    break;
+            SY::SyncState state (app.present("--sync-state").value_or(dirs[1] + "/.epictag-sync"));
+
+            // covers and other files next to the music are expected, they're left out without warnings
+            // only by extension, so the walk doesn't open a single file, syncPair checks the pairs it has to compare
+            DW::WalkOptions syncWalkOptions = walkOptions;
+            syncWalkOptions.accept = [](const std::string& path) { return FH::hasAudioExtension(path); };
+            SY::PairSource pairs (dirs[0], dirs[1], syncWalkOptions);
+
+            SY::SyncOptions syncOptions;
+            syncOptions.props = requestedProps;
+            syncOptions.pictures = requestedProps.empty() || pictureUsed;
+            syncOptions.padding = padding;
+            syncOptions.dryRun = dryRun;
+            syncOptions.verbose = verbose;
+
+            std::array<std::atomic<std::size_t>, 4> resultCounts {};
+            std::size_t pairCount = WP::forEachOrdered<SY::Pair>(
+                [&](SY::Pair& pair) {
+                    while (pairs.next(pair)) {
+                        if (wantedFile(pair.source)) return true;
+                    }
+                    return false;
+                },
+                jobs, std::cout,
+                [&](const SY::Pair& pair, std::ostream& out) {
+                    SY::syncResults result = SY::syncPair(pair, state, syncOptions, out);
+                    resultCounts[result]++;
+                    if (result && journal && (result != SY::SYNC_WRITTEN || JR::syncFile(pair.target))) journal->record(pair.source);
                 }
+            );
+
+            if (!dryRun) state.save();
+
+            if (verbose) {
+                std::cout << "Pairs: " << pairCount << ", written " << resultCounts[SY::SYNC_WRITTEN]
+                          << ", already up to date " << resultCounts[SY::SYNC_UNCHANGED]
+                          << ", unchanged since the last sync " << resultCounts[SY::SYNC_SKIPPED]
+                          << ", failed " << resultCounts[SY::SYNC_FAILED] << std::endl;
+                std::cout << "Source files without a target: " << pairs.unpairedCount() << std::endl;
+            }
+        } else if (auto socketPath = app.present("--serve")) {
+            SV::ServeOptions options;
+            options.socketPath = *socketPath;
+            options.paths = inputPaths;
+            options.walkOptions = walkOptions;
+            // the server watches for files appearing later, those shouldn't warn on every unsupported one
+            // with an index only the files it can't answer are checked, refresh does that before parsing
+            options.walkOptions.accept = [index](const std::string& path) {
+                return (index && FH::hasAudioExtension(path)) || FH::isSupportedAudio(path);
+            };
+            options.jobs = jobs;
+            options.index = index;
+            options.padding = padding;
+            options.verbose = verbose;
+
+            SV::TagServer server (options);
+            if (!server.run()) return 1;
+        } else if (interactive) {
+            IM::ShellOptions shellOptions;
+            shellOptions.cacheSize = app.get<std::size_t>("--cache-size");
+            shellOptions.padding = padding;
+
+            IM::Shell shell (shellOptions);
+            if (!inputPaths.empty()) shell.open(inputPaths, std::cout);
+            shell.run(std::cin, std::cout, isatty(STDIN_FILENO));
+        }
+
+        if (journal) {
+            journal->flush();
+            if (verbose) {
+                std::cout << "Journal: " << journal->recordedCount() << " files completed, " << skippedCount << " skipped as completed by an earlier run" << std::endl;
             }
         }
+
+        if (index) {
+            session.saveIndex();
+            // stderr in read mode, so machine readable output on stdout stays parseable
+            if (verbose) {
+                (app["-r"] == true ? std::cerr : std::cout) << "Tag index: " << index->hits() << " lookups answered from the index, " << index->misses() << " files had to be parsed" << std::endl;
+            }
+        }
+
+        // on stderr, so it can be used together with machine readable output
+        if (statsText || statsJson) ST::printSummary(std::cerr, statsJson);
     }
 
     return 0;
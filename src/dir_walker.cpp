@@ -0,0 +1,249 @@
+#include "dir_walker.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <iostream>
+#include <sys/stat.h>
+
+#include "file_handler.h"
+#include "stats.h"
+
+namespace {
+    bool matchesAny(const std::vector<std::string> &patterns, const std::string &path, const std::string &name) {
+        for (auto &pattern : patterns) {
+            const std::string &subject = pattern.find('/') != std::string::npos ? path : name;
+            if (fnmatch(pattern.c_str(), subject.c_str(), 0) == 0) return true;
+        }
+        return false;
+    }
+}
+
+bool DW::wantsFile(const WalkOptions &options, const std::string &path) {
+    std::string name = FH::getFilenameOf(path);
+    if (matchesAny(options.exclude, path, name)) return false;
+    return options.include.empty() || matchesAny(options.include, path, name);
+}
+
+bool DW::wantsDir(const WalkOptions &options, const std::string &path) {
+    return !matchesAny(options.exclude, path, FH::getFilenameOf(path));
+}
+
+DW::DirWalker::DirWalker(std::vector<std::string> paths, WalkOptions options)
+    : paths(std::move(paths)), options(std::move(options)), queue(this->options.queueSize) {
+    unsigned int threadCount = this->options.threads > 0 ? this->options.threads : 1;
+
+    for (unsigned int i = 0; i < threadCount; i++) {
+        threads.emplace_back(&DirWalker::run, this, i);
+    }
+}
+
+DW::DirWalker::~DirWalker() {
+    stop();
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+bool DW::DirWalker::next(std::string &path) {
+    return queue.pop(path);
+}
+
+void DW::DirWalker::stop() {
+    {
+        std::lock_guard lock(dirMutex);
+        stopping = true;
+    }
+    dirAvailable.notify_all();
+    listingDone.notify_all();
+    // also wakes up the walker blocked on a full queue
+    queue.close();
+}
+
+void DW::DirWalker::run(unsigned int idx) {
+    if (idx == 0) {
+        walk();
+        // tells the consumer there's nothing more coming
+        queue.close();
+
+        std::lock_guard lock(dirMutex);
+        walked = true;
+        dirAvailable.notify_all();
+        return;
+    }
+
+    // the other threads only read directories ahead of the first one
+    while (true) {
+        std::string dir;
+        std::shared_ptr<Listing> listing;
+        {
+            std::unique_lock lock(dirMutex);
+            dirAvailable.wait(lock, [this] { return stopping || walked || !pendingDirs.empty(); });
+            if (stopping || walked) break;
+
+            dir = std::move(pendingDirs.back());
+            pendingDirs.pop_back();
+            listing = listings.at(dir);
+        }
+
+        readDir(dir, *listing);
+
+        {
+            std::lock_guard lock(dirMutex);
+            listing->done = true;
+        }
+        listingDone.notify_all();
+    }
+}
+
+void DW::DirWalker::walk() {
+    for (auto &input : paths) {
+        std::string cleanPath = FH::cleanPath(input);
+
+        // skip empty paths
+        if (cleanPath.empty()) continue;
+
+        struct stat st {};
+        if (::stat(cleanPath.c_str(), &st) != 0) {
+            std::cerr << "Exception while gathering files: " << cleanPath << " does not exist" << std::endl;
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode)) {
+            if (!walkTree(cleanPath)) return;
+        } else if (options.accept && !options.accept(cleanPath)) {
+            continue;
+        } else if (!queue.push(cleanPath)) {
+            return;
+        }
+    }
+}
+
+bool DW::DirWalker::walkTree(const std::string &root) {
+    schedule({root});
+    std::vector<std::string> stack {root};
+
+    while (!stack.empty()) {
+        std::string dir = std::move(stack.back());
+        stack.pop_back();
+
+        auto listing = take(dir);
+        if (!listing) return false;
+        if (!listing->opened || !visited.insert({listing->device, listing->inode}).second) continue;
+
+        // the subdirectories are read while the files of this one are being queued
+        schedule(listing->subdirs);
+        stack.insert(stack.end(), listing->subdirs.rbegin(), listing->subdirs.rend());
+
+        for (auto &file : listing->files) {
+            // only fails once the walker was stopped
+            if (!queue.push(file)) return false;
+        }
+    }
+    return true;
+}
+
+void DW::DirWalker::schedule(const std::vector<std::string> &dirs) {
+    if (dirs.empty()) return;
+    {
+        std::lock_guard lock(dirMutex);
+        // last in is read first, so the first of dirs goes in last
+        for (auto it = dirs.rbegin(); it != dirs.rend(); ++it) {
+            listings[*it] = std::make_shared<Listing>();
+            pendingDirs.push_back(*it);
+        }
+    }
+    dirAvailable.notify_all();
+}
+
+std::shared_ptr<DW::DirWalker::Listing> DW::DirWalker::take(const std::string &dir) {
+    std::unique_lock lock(dirMutex);
+    auto listing = listings.at(dir);
+    listings.erase(dir);
+
+    if (auto pending = std::ranges::find(pendingDirs, dir); pending != pendingDirs.end()) {
+        // nobody started on it yet, faster to read it here than to wait
+        pendingDirs.erase(pending);
+        lock.unlock();
+        readDir(dir, *listing);
+        return listing;
+    }
+
+    listingDone.wait(lock, [this, &listing] { return stopping || listing->done; });
+    return stopping ? nullptr : listing;
+}
+
+void DW::DirWalker::readDir(const std::string &dir, Listing &listing) {
+    ST::Timer timer (ST::WALK);
+    DIR *handle = ::opendir(dir.c_str());
+    if (!handle) {
+        std::cerr << "Exception while gathering files: could not open directory " << dir << std::endl;
+        return;
+    }
+
+    // stat the already opened directory instead of the path, costs no extra lookup
+    struct stat dirStat {};
+    if (::fstat(::dirfd(handle), &dirStat) != 0) {
+        ::closedir(handle);
+        return;
+    }
+    listing.opened = true;
+    listing.device = dirStat.st_dev;
+    listing.inode = dirStat.st_ino;
+
+    std::string prefix = dir.back() == '/' ? dir : dir + "/";
+
+    while (dirent *entry = ::readdir(handle)) {
+        if (stopping) break;
+
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") continue;
+
+        std::string path = prefix + name;
+        bool isDir = entry->d_type == DT_DIR;
+        bool isFile = entry->d_type == DT_REG;
+
+        // the entry type is usually known from readdir already, only symlinks and filesystems
+        // that don't report types need an extra stat
+        if (entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN) {
+            struct stat st {};
+            bool isLink = entry->d_type == DT_LNK;
+            if (entry->d_type == DT_UNKNOWN && ::lstat(path.c_str(), &st) == 0) {
+                isLink = S_ISLNK(st.st_mode);
+                isDir = S_ISDIR(st.st_mode);
+                isFile = S_ISREG(st.st_mode);
+            }
+
+            // symlinked files are always followed, symlinked directories only if asked to
+            if (isLink && ::stat(path.c_str(), &st) == 0) {
+                isFile = S_ISREG(st.st_mode);
+                isDir = S_ISDIR(st.st_mode) && options.followSymlinks;
+            }
+        }
+
+        if (isDir) {
+            if (!isExcluded(path, name)) listing.subdirs.push_back(std::move(path));
+        } else if (isFile && wantsEntry(path)) {
+            listing.files.push_back(std::move(path));
+        }
+    }
+    ::closedir(handle);
+
+    // readdir order depends on the filesystem, sorted it's the same everywhere
+    std::ranges::sort(listing.files);
+    std::ranges::sort(listing.subdirs);
+}
+
+bool DW::DirWalker::wantsEntry(const std::string &path) const {
+    std::string name = FH::getFilenameOf(path);
+    if (isExcluded(path, name) || !isIncluded(path, name)) return false;
+    return !options.accept || options.accept(path);
+}
+
+bool DW::DirWalker::isExcluded(const std::string &path, const std::string &name) const {
+    return matchesAny(options.exclude, path, name);
+}
+
+bool DW::DirWalker::isIncluded(const std::string &path, const std::string &name) const {
+    return options.include.empty() || matchesAny(options.include, path, name);
+}
@@ -0,0 +1,105 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "work_pool.h"
+
+namespace DW {
+    struct WalkOptions {
+        // glob patterns (fnmatch) a found file has to match, empty means every file
+        // patterns containing a / are matched against the whole path, all others only against the filename
+        std::vector<std::string> include;
+        // glob patterns for files and directories to skip, excluded directories aren't entered at all
+        std::vector<std::string> exclude;
+        // also enter symlinked directories, every directory is still only walked once
+        bool followSymlinks = false;
+        // number of threads reading directories at the same time
+        unsigned int threads = 1;
+        // capacity of the queue between the walker and whoever consumes the paths
+        std::size_t queueSize = 4096;
+        // extra check for every file before it gets queued (e.g. FH::isSupportedAudio), runs on the walker threads
+        std::function<bool(const std::string &)> accept;
+    };
+
+    // whether a file found inside an input directory passes the include/exclude globs of options
+    bool wantsFile(const WalkOptions &options, const std::string& path);
+
+    // whether a directory inside an input directory should be entered (it isn't excluded)
+    bool wantsDir(const WalkOptions &options, const std::string& path);
+
+    // walks all input paths in the background and streams the found files into a bounded queue,
+    // so processing can start on the first file while the rest of the tree is still being walked
+    // files passed directly are queued as they are (only accept is checked for them)
+    // the order is the same on every run: inputs in the given order, directories depth first with their entries sorted
+    // by name, files before subdirectories; the threads read and check upcoming directories ahead of that order
+    class DirWalker {
+    public:
+        DirWalker(std::vector<std::string> paths, WalkOptions options);
+        ~DirWalker();
+
+        DirWalker(const DirWalker &) = delete;
+        DirWalker &operator=(const DirWalker &) = delete;
+
+        // blocks until the next file is found, false once the whole tree was walked
+        bool next(std::string &path);
+
+        // stop walking early, e.g. when only the first file is needed
+        void stop();
+
+    private:
+        // the sorted entries of one directory, read by whichever thread gets to it first
+        struct Listing {
+            bool opened = false;
+            dev_t device = 0;
+            ino_t inode = 0;
+            // files that passed the globs and accept
+            std::vector<std::string> files;
+            // directories that aren't excluded
+            std::vector<std::string> subdirs;
+            bool done = false;
+        };
+
+        void run(unsigned int idx);
+        // queues every file in order, runs on the first thread
+        void walk();
+        bool walkTree(const std::string &root);
+        // hand dirs to the reading threads, the first one of dirs is read first
+        void schedule(const std::vector<std::string> &dirs);
+        // the listing of a scheduled dir, read right here if no other thread started on it yet
+        std::shared_ptr<Listing> take(const std::string &dir);
+        void readDir(const std::string &dir, Listing &listing);
+        bool wantsEntry(const std::string &path) const;
+        bool isExcluded(const std::string &path, const std::string &name) const;
+        bool isIncluded(const std::string &path, const std::string &name) const;
+
+        std::vector<std::string> paths;
+        WalkOptions options;
+        WP::BoundedQueue<std::string> queue;
+
+        // directories waiting to be read (last one first) and listings not taken yet
+        std::mutex dirMutex;
+        std::condition_variable dirAvailable;
+        std::condition_variable listingDone;
+        std::vector<std::string> pendingDirs;
+        std::unordered_map<std::string, std::shared_ptr<Listing>> listings;
+        bool walked = false;
+        std::atomic<bool> stopping = false;
+
+        // device + inode of every directory that was entered, protects against symlink loops
+        // only used by the thread queueing the files
+        std::set<std::pair<dev_t, ino_t>> visited;
+
+        std::vector<std::thread> threads;
+    };
+}
@@ -0,0 +1,142 @@
+#include "fast_reader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <mpegfile.h>
+#include <id3v2tag.h>
+#include <tbytevectorstream.h>
+#include <xiphcomment.h>
+
+#include "file_handler.h"
+#include "stats.h"
+
+namespace {
+    // anything bigger is left to TagLib, it's most likely not a real tag
+    constexpr std::uint32_t maxTagSize = 64 * 1024 * 1024;
+
+    TagLib::ByteVector readBytes(std::ifstream &in, std::uint32_t size) {
+        TagLib::ByteVector result (size, 0);
+        in.read(result.data(), size);
+        result.resize(in.gcount());
+        ST::count(ST::BYTES_READ, result.size());
+        return result;
+    }
+
+    std::uint32_t bigEndian(const TagLib::ByteVector &data, unsigned int offset, unsigned int bytes) {
+        std::uint32_t result = 0;
+        for (unsigned int i = 0; i < bytes; i++) {
+            result = (result << 8) | static_cast<unsigned char>(data[offset + i]);
+        }
+        return result;
+    }
+
+    std::optional<TagLib::PropertyMap> xiphProps(const TagLib::ByteVector &data) {
+        TagLib::Ogg::XiphComment comment (data);
+        if (comment.isEmpty()) return std::nullopt;
+        return comment.properties();
+    }
+
+    // FLAC: "fLaC" followed by metadata blocks, each with a 4 byte header (last flag + type, 24 bit length)
+    // every block but the VORBIS_COMMENT one is skipped without reading it
+    std::optional<TagLib::PropertyMap> readFlac(std::ifstream &in) {
+        in.seekg(4);
+
+        while (in) {
+            TagLib::ByteVector header = readBytes(in, 4);
+            if (header.size() < 4) return std::nullopt;
+
+            bool last = static_cast<unsigned char>(header[0]) & 0x80;
+            int type = static_cast<unsigned char>(header[0]) & 0x7F;
+            std::uint32_t length = bigEndian(header, 1, 3);
+
+            if (type == 4) return xiphProps(readBytes(in, length));
+            if (last) break;
+            in.seekg(length, std::ios_base::cur);
+        }
+
+        // no comment block, TagLib might still find an ID3 tag
+        return std::nullopt;
+    }
+
+    // Ogg: the comment header is the second packet of the stream, packets are split over pages by lacing values
+    std::optional<TagLib::PropertyMap> readOgg(std::ifstream &in) {
+        in.seekg(0);
+
+        int packet = 0;
+        TagLib::ByteVector commentPacket;
+
+        while (in) {
+            TagLib::ByteVector header = readBytes(in, 27);
+            if (header.size() < 27 || !header.startsWith("OggS")) return std::nullopt;
+
+            int segmentCount = static_cast<unsigned char>(header[26]);
+            TagLib::ByteVector lacing = readBytes(in, segmentCount);
+            if (static_cast<int>(lacing.size()) < segmentCount) return std::nullopt;
+
+            for (int i = 0; i < segmentCount; i++) {
+                auto segmentSize = static_cast<unsigned char>(lacing[i]);
+
+                if (packet == 1) {
+                    commentPacket.append(readBytes(in, segmentSize));
+                    if (commentPacket.size() > maxTagSize) return std::nullopt;
+                } else {
+                    in.seekg(segmentSize, std::ios_base::cur);
+                }
+
+                // a lacing value below 255 ends the current packet
+                if (segmentSize < 255) {
+                    packet++;
+                    if (packet == 2) {
+                        if (commentPacket.startsWith("\x03vorbis")) return xiphProps(commentPacket.mid(7));
+                        if (commentPacket.startsWith("OpusTags")) return xiphProps(commentPacket.mid(8));
+                        // speex, flac in ogg ... are left to TagLib
+                        return std::nullopt;
+                    }
+                }
+            }
+        }
+        return std::nullopt;
+    }
+
+    // ID3v2 in front of MPEG audio: the 10 byte header says how big the tag is, only that much gets read
+    // and handed to TagLib's own ID3v2 parser through an in-memory stream
+    std::optional<TagLib::PropertyMap> readId3v2(std::ifstream &in, const TagLib::ByteVector &header) {
+        // the size is a syncsafe integer - 7 bits per byte
+        std::uint32_t size = 0;
+        for (int i = 6; i < 10; i++) {
+            size = (size << 7) | (static_cast<unsigned char>(header[i]) & 0x7F);
+        }
+        // footer present flag
+        if (static_cast<unsigned char>(header[5]) & 0x10) size += 10;
+        if (size > maxTagSize) return std::nullopt;
+
+        TagLib::ByteVector tag = header;
+        tag.append(readBytes(in, size));
+
+        TagLib::ByteVectorStream stream (tag);
+        TagLib::MPEG::File mpeg (&stream, false);
+        auto id3v2 = mpeg.ID3v2Tag();
+        if (!id3v2 || id3v2->isEmpty()) return std::nullopt;
+        return id3v2->properties();
+    }
+}
+
+std::optional<TagLib::PropertyMap> FR::readTagProps(const std::string &path) {
+    std::ifstream in (path, std::ios_base::in | std::ios_base::binary);
+    if (!in) return std::nullopt;
+
+    TagLib::ByteVector header = readBytes(in, 10);
+    if (header.size() < 10) return std::nullopt;
+
+    if (header.startsWith("fLaC")) return readFlac(in);
+    if (header.startsWith("OggS")) return readOgg(in);
+
+    // ID3v2 can also sit in front of other formats, which might use another tag type instead, so only .mp3 is handled
+    std::string ext = FH::getExtOf(path);
+    std::ranges::transform(ext, ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    if (header.startsWith("ID3") && ext == ".mp3") return readId3v2(in, header);
+
+    return std::nullopt;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <optional>
+#include <string>
+#include <tpropertymap.h>
+
+namespace FR {
+    // read the properties of a file straight from its tag block, without going through FileRef
+    // only the bytes of the tag itself are read - no audio properties, no scanning for frames
+    // covers ID3v2 in .mp3 files, FLAC VORBIS_COMMENT blocks and Ogg Vorbis/Opus comment headers
+    // returns nullopt if the file isn't one of those or looks unusual (e.g. the tag is empty and
+    // another tag type might be used instead), the caller should fall back to a FileRef then
+    // not timed on its own, the caller times the parse of the file including any fallback as one ST::PARSE sample
+    std::optional<TagLib::PropertyMap> readTagProps(const std::string& path);
+}
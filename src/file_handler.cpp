@@ -1,9 +1,17 @@
 #include "file_handler.h"
 
-#include <fileref.h>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
 #include <iostream>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.h"
 
 namespace fs = std::filesystem;
 
@@ -59,14 +67,13 @@ std::vector<std::string> FH::gatherAllFilesFromList(const std::vector<std::strin
     }
 
     // filter the file list and remove any files not supported by TagLib
-    // it might be slower than just checking the extension, but it should be more robust and ensures that
-    // the file will be usable later on in the code
+    // only the extension and a small header read are checked here, the file gets opened for real only once
+    // in the processing loop, which also handles files that pass this check but TagLib still can't read
     if (forTaglib)
     std::erase_if(
         result,
         [](const std::string& path) {
-            TagLib::FileRef f (path.data());
-            if (f.isNull()) {
+            if (!isSupportedAudio(path)) {
                 std::cerr << "WARN: Unsupported file provided as input: " << getFilenameOf(path) << std::endl;
                 return true;
             } else {
@@ -78,6 +85,101 @@ std::vector<std::string> FH::gatherAllFilesFromList(const std::vector<std::strin
     return result;
 }
 
+namespace {
+    // how many bytes of the file header are needed to tell the formats apart, the longest magic is the 17 bytes of "Extended Module: "
+    constexpr std::size_t sniffSize = 17;
+
+    // extensions TagLib picks a file type for, see FileRef::defaultFileExtensions
+    const std::array<std::string_view, 34> audioExts = {
+        ".mp3", ".mp2", ".aac", ".ogg", ".oga", ".opus", ".spx", ".flac", ".mpc", ".wv", ".tta",
+        ".m4a", ".m4r", ".m4b", ".m4p", ".mp4", ".m4v", ".3g2", ".wma", ".asf", ".aif", ".aiff",
+        ".afc", ".aifc", ".wav", ".ape", ".dsf", ".dff", ".shn", ".mod", ".module", ".nst", ".s3m", ".it",
+    };
+
+    // tracker modules have no fixed magic at the start of the file, so only the extension is checked for them
+    const std::array<std::string_view, 5> moduleExts = {".mod", ".module", ".nst", ".s3m", ".xm"};
+
+    bool headerStartsWith(const std::string& header, std::size_t offset, std::string_view magic) {
+        return header.size() >= offset + magic.size() && header.compare(offset, magic.size(), magic) == 0;
+    }
+
+    // true if the header unambiguously belongs to one of the container formats TagLib can read
+    bool hasAudioMagic(const std::string& header) {
+        static const std::string asfGuid ("\x30\x26\xB2\x75\x8E\x66\xCF\x11", 8);
+
+        return headerStartsWith(header, 0, "fLaC")
+            || headerStartsWith(header, 0, "OggS")
+            || headerStartsWith(header, 4, "ftyp")
+            || (headerStartsWith(header, 0, "RIFF") && headerStartsWith(header, 8, "WAVE"))
+            || (headerStartsWith(header, 0, "FORM") && (headerStartsWith(header, 8, "AIFF") || headerStartsWith(header, 8, "AIFC")))
+            || headerStartsWith(header, 0, asfGuid)
+            || headerStartsWith(header, 0, "MAC ")
+            || headerStartsWith(header, 0, "MPCK")
+            || headerStartsWith(header, 0, "MP+")
+            || headerStartsWith(header, 0, "wvpk")
+            || headerStartsWith(header, 0, "TTA1")
+            || headerStartsWith(header, 0, "DSD ")
+            || headerStartsWith(header, 0, "FRM8")
+            || headerStartsWith(header, 0, "ajkg")
+            || headerStartsWith(header, 0, "IMPM")
+            || headerStartsWith(header, 0, "Extended Module: ");
+    }
+
+    // ID3v2 tags and raw MPEG frames can be in front of several formats, so they only count together with the extension
+    bool hasPrefixMagic(const std::string& header) {
+        if (headerStartsWith(header, 0, "ID3")) return true;
+
+        // MPEG/ADTS frame sync - 11 set bits
+        return header.size() >= 2
+            && static_cast<unsigned char>(header[0]) == 0xFF
+            && (static_cast<unsigned char>(header[1]) & 0xE0) == 0xE0;
+    }
+
+    bool sniffAudio(const std::string &path) {
+        std::string ext = FH::getExtOf(path);
+        std::ranges::transform(ext, ext.begin(), [](unsigned char c) { return std::tolower(c); });
+
+        if (std::ranges::find(moduleExts, ext) != moduleExts.end()) return true;
+
+        std::ifstream file (path, std::ios_base::in | std::ios_base::binary);
+        if (!file) return false;
+
+        // one small read is enough, there's no need to go through TagLib (and parse the whole tag) just for this
+        std::string header (sniffSize, '\0');
+        file.read(header.data(), sniffSize);
+        header.resize(file.gcount());
+        ST::count(ST::BYTES_READ, header.size());
+
+        if (hasAudioMagic(header)) return true;
+        return hasPrefixMagic(header) && std::ranges::find(audioExts, ext) != audioExts.end();
+    }
+}
+
+bool FH::isSupportedAudio(const std::string &path) {
+    ST::Timer timer (ST::SNIFF);
+    ST::count(ST::FILES_SCANNED);
+
+    bool supported = sniffAudio(path);
+    if (!supported) ST::count(ST::FILES_UNSUPPORTED);
+    return supported;
+}
+
+bool FH::hasAudioExtension(const std::string &path) {
+    std::string ext = getExtOf(path);
+    std::ranges::transform(ext, ext.begin(), [](unsigned char c) { return std::tolower(c); });
+    return std::ranges::find(audioExts, ext) != audioExts.end() || std::ranges::find(moduleExts, ext) != moduleExts.end();
+}
+
+std::string FH::makeTempFile(const std::string &path) {
+    std::string tmp = path + ".XXXXXX";
+    int fd = ::mkstemp(tmp.data());
+    if (fd < 0) return "";
+    // mkstemp only gives the owner access, the replaced files were always readable by everyone
+    ::fchmod(fd, 0644);
+    ::close(fd);
+    return tmp;
+}
+
 std::string FH::getFilenameOf(const std::string &path) {
     return fs::path(path).filename().string();
 }
@@ -90,16 +192,22 @@ TagLib::ByteVector FH::getImgByteVector(const std::string &imgPath) {
         return result;
     }
 
-    std::ifstream imgData (imgPath, std::ios_base::in | std::ios_base::binary);
-
-    // read the image data per byte
-    char byte;
-    imgData.read(&byte,1);
-    while (imgData) {
-        result.append(byte);
-        imgData.read(&byte,1);
+    ST::Timer timer (ST::IMAGE_IO);
+    std::ifstream imgData (imgPath, std::ios_base::in | std::ios_base::binary | std::ios_base::ate);
+    if (!imgData) {
+        std::cerr << "Could not open image " << imgPath << std::endl;
+        return result;
     }
 
+    // opened at the end, so the position is the file size
+    // the whole image is read in one go straight into the vector's buffer
+    auto size = static_cast<std::streamsize>(imgData.tellg());
+    imgData.seekg(0);
+    result.resize(size);
+    imgData.read(result.data(), size);
+    result.resize(imgData.gcount());
+    ST::count(ST::BYTES_READ, result.size());
+
     imgData.close();
     return result;
 }
@@ -112,13 +220,15 @@ std::string FH::getDirOf(const std::string &path) {
     return fs::path(path).parent_path().string();
 }
 
-bool FH::exportFile(TagLib::ByteVector data, const std::string &filename) {
+bool FH::exportFile(const TagLib::ByteVector &data, const std::string &filename) {
     fs::path outPath (filename);
 
     try {
+        ST::Timer timer (ST::IMAGE_IO);
         std::ofstream of (outPath, std::ios_base::out | std::ios_base::binary);
         of << data;
         of.close();
+        ST::count(ST::BYTES_WRITTEN, data.size());
         return true;
     } catch (const std::exception &e) {
         std::cerr << "Exception while exporting data to " << outPath << ":" << e.what() << std::endl;
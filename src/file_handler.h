@@ -14,8 +14,22 @@ namespace FH {
     std::vector<std::string> getAllFilesInDir(const std::string& dirPath);
 
     // make a list of all individual files from list of paths (potentially containing both file and directory paths)
+    // forTaglib drops every file that doesn't look like audio TagLib can open, see isSupportedAudio
     std::vector<std::string> gatherAllFilesFromList(const std::vector<std::string> &, bool forTaglib);
 
+    // cheap check if the file looks like a format TagLib supports, based on the extension and the first few bytes
+    // doesn't parse anything, so the caller still has to check FileRef::isNull when opening the file for real
+    bool isSupportedAudio(const std::string& path);
+
+    // whether the extension is one TagLib picks a file type for, doesn't touch the file at all
+    // for walks where most files are never opened, isSupportedAudio then only has to run on the ones that are
+    bool hasAudioExtension(const std::string& path);
+
+    // create an empty file with a unique name in the directory of path, to write a replacement for path into
+    // that is then renamed over it, two processes replacing the same file never share one
+    // returns the path of the new file, an empty string if it couldn't be created
+    std::string makeTempFile(const std::string& path);
+
     // get the filename of a given path (the part at the very end with the extension)
     std::string getFilenameOf(const std::string& path);
 
@@ -29,5 +43,5 @@ namespace FH {
     TagLib::ByteVector getImgByteVector(const std::string& path);
 
     // export the data as a file to the system
-    bool exportFile(TagLib::ByteVector data, const std::string &filename);
+    bool exportFile(const TagLib::ByteVector &data, const std::string &filename);
 }
@@ -0,0 +1,142 @@
+#include "image_store.h"
+
+#include <atomic>
+#include <future>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include "file_handler.h"
+#include "tag_index.h"
+
+namespace {
+    // images of recently used paths stay loaded up to this size, beyond that the least recently used are dropped
+    constexpr std::size_t maxCachedBytes = 128 * 1024 * 1024;
+
+    struct CacheEntry {
+        TI::FileStamp stamp;
+        // a shared_future so threads asking for an image that is still being read just wait for it
+        std::shared_future<std::shared_ptr<const IS::Image>> image;
+        // which read filled the entry, a newer read of the same path replaces it
+        std::uint64_t load = 0;
+        // size of the image once it's loaded, still reading counts as nothing
+        std::size_t bytes = 0;
+        std::list<std::string>::iterator use;
+    };
+
+    std::mutex storeMutex;
+    std::unordered_map<std::string, CacheEntry> byPath;
+    // most recently used path first
+    std::list<std::string> recentPaths;
+    std::size_t cachedBytes = 0;
+    std::uint64_t loads = 0;
+    // weak, so a buffer is freed once no path and no file uses it anymore
+    std::unordered_map<std::uint64_t, std::weak_ptr<const IS::Image>> byHash;
+    std::atomic<std::size_t> reads = 0;
+
+    std::shared_ptr<const IS::Image> loadImage(const std::string &path) {
+        auto image = std::make_shared<IS::Image>();
+        image->data = FH::getImgByteVector(path);
+        image->mimeType = IS::detectMimeType(image->data);
+        image->hash = IS::hashBytes(image->data.data(), image->data.size());
+        reads++;
+
+        // reuse the buffer of an identical image that's already loaded
+        std::lock_guard lock(storeMutex);
+        auto &known = byHash[image->hash];
+        if (auto existing = known.lock(); existing && existing->data == image->data) {
+            return existing;
+        }
+        known = image;
+        return image;
+    }
+
+    // storeMutex has to be held
+    void dropEntry(std::unordered_map<std::string, CacheEntry>::iterator it) {
+        cachedBytes -= it->second.bytes;
+        recentPaths.erase(it->second.use);
+        byPath.erase(it);
+    }
+
+    // storeMutex has to be held, the most recent path is kept even if it's larger than the whole budget
+    void evictOverBudget() {
+        while (cachedBytes > maxCachedBytes && recentPaths.size() > 1) {
+            dropEntry(byPath.find(recentPaths.back()));
+        }
+    }
+
+    // storeMutex has to be held, end() if the entry was replaced or dropped since the read started
+    std::unordered_map<std::string, CacheEntry>::iterator findLoad(const std::string &path, std::uint64_t load) {
+        auto it = byPath.find(path);
+        if (it != byPath.end() && it->second.load != load) return byPath.end();
+        return it;
+    }
+}
+
+std::shared_ptr<const IS::Image> IS::get(const std::string &path) {
+    TI::FileStamp stamp;
+    TI::statFile(path, stamp);
+
+    std::promise<std::shared_ptr<const Image>> promise;
+    std::shared_future<std::shared_ptr<const Image>> cached;
+    std::uint64_t load = 0;
+    {
+        std::lock_guard lock(storeMutex);
+        auto it = byPath.find(path);
+        if (it != byPath.end() && it->second.stamp == stamp) {
+            recentPaths.splice(recentPaths.begin(), recentPaths, it->second.use);
+            cached = it->second.image;
+        } else {
+            if (it != byPath.end()) dropEntry(it);
+            load = ++loads;
+            recentPaths.push_front(path);
+            byPath[path] = {stamp, promise.get_future().share(), load, 0, recentPaths.begin()};
+        }
+    }
+
+    // either already loaded or being loaded by another thread right now, wait outside the lock
+    if (cached.valid()) return cached.get();
+
+    try {
+        auto image = loadImage(path);
+        promise.set_value(image);
+
+        std::lock_guard lock(storeMutex);
+        if (auto it = findLoad(path, load); it != byPath.end()) {
+            it->second.bytes = image->data.size();
+            cachedBytes += it->second.bytes;
+            evictOverBudget();
+        }
+        return image;
+    } catch (...) {
+        // hand the error to every thread waiting for this image too
+        promise.set_exception(std::current_exception());
+        // the next request tries again instead of getting the same error
+        std::lock_guard lock(storeMutex);
+        if (auto it = findLoad(path, load); it != byPath.end()) dropEntry(it);
+        throw;
+    }
+}
+
+TagLib::String IS::detectMimeType(const TagLib::ByteVector &data) {
+    if (data.startsWith("\x89PNG\x0d\x0a\x1a\x0a")) return "image/png";
+    if (data.startsWith("GIF87a") || data.startsWith("GIF89a")) return "image/gif";
+    if (data.startsWith("BM")) return "image/bmp";
+    if (data.startsWith("RIFF") && data.size() >= 12 && data.mid(8, 4) == "WEBP") return "image/webp";
+
+    // jpeg (FF D8 FF) is also what everything unknown was treated as before
+    return "image/jpeg";
+}
+
+std::uint64_t IS::hashBytes(const char *data, std::size_t size) {
+    std::uint64_t hash = 14695981039346656037ull;
+    for (std::size_t i = 0; i < size; i++) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::size_t IS::readCount() {
+    return reads;
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <tbytevector.h>
+#include <tstring.h>
+
+namespace IS {
+    // an image loaded for embedding, shared by every file it gets embedded into
+    struct Image {
+        TagLib::ByteVector data;
+        TagLib::String mimeType;
+        std::uint64_t hash = 0;
+    };
+
+    // get the image at path, it's only read from disk the first time it's requested
+    // (or again once its size or mtime changed), later calls get the same shared buffer
+    // only the most recently used images stay loaded, once they take up more than 128 MiB the oldest are read again when needed
+    // images with identical contents share a buffer even if they come from different paths
+    // safe to call from multiple threads, concurrent requests for the same path wait for a single read
+    std::shared_ptr<const Image> get(const std::string& path);
+
+    // detect the MIME type of image data from its magic number, falls back to image/jpeg
+    TagLib::String detectMimeType(const TagLib::ByteVector &data);
+
+    // 64-bit FNV-1a hash of the data, used to tell image contents apart
+    std::uint64_t hashBytes(const char *data, std::size_t size);
+
+    // number of images actually read from disk so far
+    std::size_t readCount();
+}
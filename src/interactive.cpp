@@ -0,0 +1,361 @@
+#include "interactive.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <sstream>
+
+#include "file_handler.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    std::string normalize(const std::string &path) {
+        std::error_code ec;
+        fs::path absolute = fs::absolute(FH::cleanPath(path), ec);
+        return (ec ? fs::path(path) : absolute).lexically_normal().string();
+    }
+
+    std::string upper(std::string value) {
+        std::ranges::transform(value, value.begin(), [](unsigned char c) { return std::toupper(c); });
+        return value;
+    }
+
+    const char *helpText =
+        "  open PATH...          open files (directories are opened recursively) and select them\n"
+        "  files                 list the selection, * marks pending edits\n"
+        "  read [KEY...]         tags of the selection including pending edits, all tags without keys\n"
+        "  set KEY=VALUE...      stage new values, repeating a key gives several values, KEY= removes the tag\n"
+        "  add-picture IMAGE...  stage pictures to append\n"
+        "  diff                  pending edits of the selection compared to the files\n"
+        "  commit                save every file with pending edits, one save per file\n"
+        "  discard               drop the pending edits of the selection\n"
+        "  stats                 cache size, hits and misses\n"
+        "  help, quit\n"
+        "Values with spaces need quotes, e.g. set TITLE=\"Blue in Green\"\n";
+}
+
+bool IM::OpenFile::hasPending() const {
+    return !pending.props.empty() || !pending.propLists.empty() || !pending.pictures.empty() || pending.replacePictures;
+}
+
+IM::FileCache::FileCache(std::size_t capacity) : capacity(std::max<std::size_t>(capacity, 1)) {
+}
+
+IM::OpenFile *IM::FileCache::get(const std::string &path) {
+    std::string key = normalize(path);
+    TI::FileStamp stamp;
+    bool stamped = TI::statFile(key, stamp);
+
+    if (auto it = byPath.find(key); it != byPath.end()) {
+        auto entry = it->second;
+        files.splice(files.begin(), files, entry);
+
+        // pending edits are kept even if the file changed, commit refuses to overwrite it then
+        if (entry->hasPending() || !stamped || entry->stamp == stamp) {
+            hitCount++;
+            return &*entry;
+        }
+        files.erase(entry);
+        byPath.erase(it);
+    }
+
+    missCount++;
+    TagLib::FileRef f (key.data());
+    if (f.isNull()) return nullptr;
+
+    files.push_front({key, f, stamp, {}});
+    byPath[key] = files.begin();
+    evict();
+    return &files.front();
+}
+
+std::vector<IM::OpenFile *> IM::FileCache::pendingFiles() {
+    std::vector<OpenFile *> result;
+    for (auto &file : files) {
+        if (file.hasPending()) result.push_back(&file);
+    }
+    return result;
+}
+
+bool IM::FileCache::reopen(OpenFile &file) {
+    missCount++;
+    TagLib::FileRef f (file.path.data());
+    if (f.isNull()) {
+        auto it = byPath.find(file.path);
+        files.erase(it->second);
+        byPath.erase(it);
+        return false;
+    }
+    file.f = f;
+    TI::statFile(file.path, file.stamp);
+    return true;
+}
+
+void IM::FileCache::evict() {
+    // least recently used first, skipping files with pending edits
+    for (auto it = files.end(); files.size() > capacity && it != files.begin();) {
+        --it;
+        if (it->hasPending()) continue;
+        byPath.erase(it->path);
+        it = files.erase(it);
+    }
+}
+
+std::size_t IM::FileCache::size() const {
+    return files.size();
+}
+
+std::size_t IM::FileCache::hits() const {
+    return hitCount;
+}
+
+std::size_t IM::FileCache::misses() const {
+    return missCount;
+}
+
+IM::Shell::Shell(ShellOptions options) : options(options), cache(options.cacheSize) {
+}
+
+void IM::Shell::run(std::istream &in, std::ostream &out, bool prompt) {
+    std::string line;
+    while (true) {
+        if (prompt) out << "epictag> " << std::flush;
+        if (!std::getline(in, line)) {
+            if (prompt) out << std::endl;
+            // end of input quits too, but the warning about pending edits still applies
+            if (!quit(out)) continue;
+            break;
+        }
+        if (!execute(line, out)) break;
+    }
+}
+
+bool IM::Shell::execute(const std::string &line, std::ostream &out) {
+    auto args = splitArgs(line);
+    if (args.empty()) return true;
+
+    std::string command = args.front();
+    args.erase(args.begin());
+    std::ranges::transform(command, command.begin(), [](unsigned char c) { return std::tolower(c); });
+
+    // anything but a second quit takes the quit warning back
+    if (command != "quit" && command != "exit") quitWarned = false;
+
+    try {
+        if (command == "open") open(args, out);
+        else if (command == "files") forSelected(out, [&out](OpenFile &file) {
+            out << (file.hasPending() ? "* " : "  ") << file.path << std::endl;
+        });
+        else if (command == "read") read(args, out);
+        else if (command == "set") set(args, out);
+        else if (command == "add-picture") addPicture(args, out);
+        else if (command == "diff") diff(out);
+        else if (command == "commit") commit(out);
+        else if (command == "discard") discard(out);
+        else if (command == "stats") {
+            out << "Open files: " << cache.size() << ", cache hits: " << cache.hits() << ", files parsed: " << cache.misses() << std::endl;
+        }
+        else if (command == "help") out << helpText;
+        else if (command == "quit" || command == "exit") return !quit(out);
+        else out << "Unknown command " << command << ", type help for a list" << std::endl;
+    } catch (const std::exception &e) {
+        out << "Exception while running " << command << ": " << e.what() << std::endl;
+    }
+    return true;
+}
+
+void IM::Shell::open(const std::vector<std::string> &args, std::ostream &out) {
+    if (args.empty()) {
+        out << "open needs at least one file or directory" << std::endl;
+        return;
+    }
+
+    selection = FH::gatherAllFilesFromList(args, true);
+    std::size_t opened = 0;
+    forSelected(out, [&opened](OpenFile &) { opened++; });
+    out << opened << " files open" << std::endl;
+}
+
+void IM::Shell::read(const std::vector<std::string> &args, std::ostream &out) {
+    std::unordered_set<int> requested;
+    for (auto &key : args) {
+        int type = TM::findPropTypeByKey(upper(key));
+        if (type == TM::UNDEFINED) {
+            out << "Unknown tag key " << key << std::endl;
+            return;
+        }
+        requested.insert(type);
+    }
+
+    forSelected(out, [&](OpenFile &file) {
+        // the file's own tags with the pending edits on top
+        auto props = TM::readAllProps(file.f);
+        for (auto &[type, value] : file.pending.props) props[type] = TagLib::StringList(TagLib::String(value, TagLib::String::UTF8));
+        for (auto &[type, values] : file.pending.propLists) {
+            if (values.isEmpty()) props.erase(type);
+            else props[type] = values;
+        }
+
+        out << "Properties of file: " << FH::getFilenameOf(file.path) << (file.hasPending() ? " (with pending edits)" : "") << std::endl;
+        TM::printProps(requested.empty() ? props : TM::selectProps(props, requested), out);
+        if (!file.pending.pictures.empty()) {
+            out << "    PICTURE: " << file.pending.pictures.size() << " pending" << std::endl;
+        }
+        out << std::endl;
+    });
+}
+
+void IM::Shell::set(const std::vector<std::string> &args, std::ostream &out) {
+    std::map<int, TagLib::StringList> values;
+    for (auto &arg : args) {
+        auto separator = arg.find('=');
+        if (separator == std::string::npos) {
+            out << "Expected KEY=VALUE, got " << arg << std::endl;
+            return;
+        }
+        int type = TM::findPropTypeByKey(upper(arg.substr(0, separator)));
+        if (type == TM::UNDEFINED) {
+            out << "Unknown tag key " << arg.substr(0, separator) << std::endl;
+            return;
+        }
+
+        // KEY= leaves the list empty, which removes the tag
+        auto &list = values[type];
+        if (separator + 1 < arg.size()) list.append(TagLib::String(arg.substr(separator + 1), TagLib::String::UTF8));
+    }
+    if (values.empty()) {
+        out << "set needs at least one KEY=VALUE" << std::endl;
+        return;
+    }
+
+    std::size_t staged = 0;
+    forSelected(out, [&](OpenFile &file) {
+        for (auto &[type, list] : values) file.pending.propLists[type] = list;
+        staged++;
+    });
+    out << "Staged for " << staged << " files" << std::endl;
+}
+
+void IM::Shell::addPicture(const std::vector<std::string> &args, std::ostream &out) {
+    auto images = FH::gatherAllFilesFromList(args, false);
+    if (images.empty()) {
+        out << "add-picture needs at least one image" << std::endl;
+        return;
+    }
+
+    std::size_t staged = 0;
+    forSelected(out, [&](OpenFile &file) {
+        file.pending.pictures.insert(file.pending.pictures.end(), images.begin(), images.end());
+        staged++;
+    });
+    out << "Staged " << images.size() << " pictures for " << staged << " files" << std::endl;
+}
+
+void IM::Shell::diff(std::ostream &out) {
+    forSelected(out, [&out](OpenFile &file) {
+        if (!file.hasPending()) return;
+        out << "Changes to " << file.path << ":" << std::endl;
+        TM::printDiff(TM::diffEdits(file.f, file.pending), out);
+        out << std::endl;
+    });
+}
+
+void IM::Shell::commit(std::ostream &out) {
+    auto pending = cache.pendingFiles();
+    if (pending.empty()) {
+        out << "Nothing to commit" << std::endl;
+        return;
+    }
+
+    for (auto *file : pending) {
+        // saving over changes made by someone else would silently undo them
+        TI::FileStamp stamp;
+        if (TI::statFile(file->path, stamp) && stamp != file->stamp) {
+            out << "Not saving " << file->path << ", it was changed on disk since it was opened. Use discard and set again" << std::endl;
+            continue;
+        }
+
+        file->pending.padding = options.padding;
+        TM::commitResults result = TM::commitEdits(file->f, file->pending);
+        if (!result) {
+            // the edits were already staged into the FileRef, it has to be parsed again to show what's on disk
+            // otherwise the next commit would see no difference and drop the edits without saving them
+            out << "Could not save changes to " << file->path;
+            if (cache.reopen(*file)) out << ", the edits are kept" << std::endl;
+            else out << ", it can't be opened anymore and its edits were dropped" << std::endl;
+            continue;
+        }
+        out << "Saved " << FH::getFilenameOf(file->path) << ": " << TM::commitResultName(result) << std::endl;
+
+        file->pending = {};
+        // a rewritten file is a new file (new inode), so the FileRef is opened again on the next use
+        TI::statFile(file->path, file->stamp);
+        if (result == TM::COMMIT_REWRITTEN) file->stamp = {};
+    }
+}
+
+void IM::Shell::discard(std::ostream &out) {
+    std::size_t discarded = 0;
+    forSelected(out, [&discarded](OpenFile &file) {
+        if (file.hasPending()) discarded++;
+        file.pending = {};
+    });
+    out << "Discarded the pending edits of " << discarded << " files" << std::endl;
+}
+
+bool IM::Shell::quit(std::ostream &out) {
+    std::size_t pending = cache.pendingFiles().size();
+    if (pending == 0 || quitWarned) return true;
+
+    out << pending << " files have pending edits, commit them or quit again to drop them" << std::endl;
+    quitWarned = true;
+    return false;
+}
+
+void IM::Shell::forSelected(std::ostream &out, const std::function<void(OpenFile &)> &fn) {
+    if (selection.empty()) {
+        out << "No files open, use open PATH first" << std::endl;
+        return;
+    }
+
+    for (auto &path : selection) {
+        OpenFile *file = cache.get(path);
+        if (!file) {
+            out << "WARN: Unsupported file: " << FH::getFilenameOf(path) << std::endl;
+            continue;
+        }
+        fn(*file);
+    }
+}
+
+std::vector<std::string> IM::splitArgs(const std::string &line) {
+    std::vector<std::string> args;
+    std::string current;
+    bool inArg = false;
+    char quote = 0;
+
+    for (std::size_t i = 0; i < line.size(); i++) {
+        char c = line[i];
+        if (quote) {
+            if (c == quote) quote = 0;
+            else if (c == '\\' && quote == '"' && i + 1 < line.size()) current += line[++i];
+            else current += c;
+        } else if (c == '"' || c == '\'') {
+            quote = c;
+            inArg = true;
+        } else if (c == '\\' && i + 1 < line.size()) {
+            current += line[++i];
+            inArg = true;
+        } else if (std::isspace(static_cast<unsigned char>(c))) {
+            if (inArg) args.push_back(std::move(current));
+            current.clear();
+            inArg = false;
+        } else {
+            current += c;
+            inArg = true;
+        }
+    }
+    if (inArg) args.push_back(std::move(current));
+    return args;
+}
@@ -0,0 +1,113 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fileref.h>
+#include <functional>
+#include <iostream>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tag_index.h"
+#include "tag_manager.h"
+
+namespace IM {
+    // a file kept open between commands, with the edits that haven't been committed yet
+    struct OpenFile {
+        std::string path;
+        TagLib::FileRef f;
+        // the file as it was parsed, a different stamp on disk means it was changed by someone else
+        TI::FileStamp stamp;
+        TM::EditBatch pending;
+
+        bool hasPending() const;
+    };
+
+    // least recently used cache of parsed files
+    // files with pending edits are never evicted, so edits are only lost by discarding them
+    class FileCache {
+    public:
+        explicit FileCache(std::size_t capacity);
+
+        // the open file at path, parsed only if it isn't cached yet or changed on disk without pending edits
+        // null if the file isn't supported
+        OpenFile *get(const std::string& path);
+
+        // every cached file with pending edits, most recently used first
+        std::vector<OpenFile *> pendingFiles();
+
+        // parse file again from disk, keeping its pending edits
+        // false if it can't be parsed anymore, the file is dropped from the cache then
+        bool reopen(OpenFile &file);
+
+        std::size_t size() const;
+        std::size_t hits() const;
+        std::size_t misses() const;
+
+    private:
+        void evict();
+
+        std::size_t capacity;
+        // most recently used first
+        std::list<OpenFile> files;
+        std::unordered_map<std::string, std::list<OpenFile>::iterator> byPath;
+        std::size_t hitCount = 0;
+        std::size_t missCount = 0;
+    };
+
+    struct ShellOptions {
+        // files kept parsed at once (files with pending edits don't count towards it)
+        std::size_t cacheSize = 64;
+        // see TM::EditBatch
+        std::uint64_t padding = 4096;
+    };
+
+    // line based command interpreter working on a selection of open files
+    //   open PATH...          open files (directories are opened recursively) and select them
+    //   files                 list the selection, * marks pending edits
+    //   read [KEY...]         tags of the selection including pending edits, all tags without keys
+    //   set KEY=VALUE...      stage new values, repeating a key gives several values, KEY= removes the tag
+    //   add-picture IMAGE...  stage pictures to append
+    //   diff                  pending edits of the selection compared to the files
+    //   commit                save every file with pending edits, one save per file
+    //   discard               drop the pending edits of the selection
+    //   stats                 cache size, hits and misses
+    //   help, quit
+    // arguments are split on whitespace, "double" or 'single' quotes keep spaces, e.g. set TITLE="Blue in Green"
+    class Shell {
+    public:
+        explicit Shell(ShellOptions options = {});
+
+        // read commands until quit or the end of in, prompts are only shown if in is a terminal
+        void run(std::istream &in, std::ostream &out, bool prompt);
+
+        // run a single command line, false once the shell should exit
+        bool execute(const std::string& line, std::ostream &out);
+
+        // same as the open command, e.g. for the input files on the command line
+        void open(const std::vector<std::string> &paths, std::ostream &out);
+
+    private:
+        void read(const std::vector<std::string> &args, std::ostream &out);
+        void set(const std::vector<std::string> &args, std::ostream &out);
+        void addPicture(const std::vector<std::string> &args, std::ostream &out);
+        void diff(std::ostream &out);
+        void commit(std::ostream &out);
+        void discard(std::ostream &out);
+        bool quit(std::ostream &out);
+
+        // run fn on every selected file, one at a time since getting a file can evict another one
+        // unsupported files are reported and skipped
+        void forSelected(std::ostream &out, const std::function<void(OpenFile &)> &fn);
+
+        ShellOptions options;
+        FileCache cache;
+        std::vector<std::string> selection;
+        // quitting with pending edits has to be confirmed by a second quit
+        bool quitWarned = false;
+    };
+
+    // split a command line into arguments, see Shell
+    std::vector<std::string> splitArgs(const std::string& line);
+}
@@ -0,0 +1,135 @@
+#include "journal.h"
+
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <unistd.h>
+
+#include "image_store.h"
+#include "output_writer.h"
+
+namespace {
+    // entries written per fsync, a crash redoes at most this many files
+    constexpr std::size_t batchSize = 256;
+}
+
+std::optional<JR::Shard> JR::parseShard(std::string_view value) {
+    auto separator = value.find('/');
+    if (separator == std::string_view::npos) return std::nullopt;
+
+    Shard shard;
+    auto index = value.substr(0, separator);
+    auto count = value.substr(separator + 1);
+    auto [indexEnd, indexEc] = std::from_chars(index.data(), index.data() + index.size(), shard.index);
+    auto [countEnd, countEc] = std::from_chars(count.data(), count.data() + count.size(), shard.count);
+    if (indexEc != std::errc() || indexEnd != index.data() + index.size()) return std::nullopt;
+    if (countEc != std::errc() || countEnd != count.data() + count.size()) return std::nullopt;
+    if (shard.count == 0 || shard.index == 0 || shard.index > shard.count) return std::nullopt;
+    return shard;
+}
+
+bool JR::inShard(const std::string &path, const Shard &shard) {
+    return IS::hashBytes(path.data(), path.size()) % shard.count == shard.index - 1;
+}
+
+bool JR::syncFile(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    bool synced = ::fsync(fd) == 0;
+    ::close(fd);
+    if (!synced) std::cerr << "WARN: Could not flush " << path << " to disk, it stays out of the journal" << std::endl;
+    return synced;
+}
+
+JR::Journal::Journal(std::string journalPath, bool resume) : journalPath(std::move(journalPath)) {
+    if (resume) {
+        std::ifstream in (this->journalPath, std::ios_base::in | std::ios_base::binary);
+        std::string line;
+        while (std::getline(in, line)) {
+            // getline also returns a last line without a newline, which is a write cut short
+            if (in.eof()) break;
+            done.insert(OW::unescapeTsv(line));
+        }
+    }
+
+    fd = ::open(this->journalPath.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (resume ? 0 : O_TRUNC), 0644);
+    if (fd < 0) {
+        std::cerr << "Could not open journal " << this->journalPath << ": " << std::strerror(errno) << std::endl;
+        return;
+    }
+
+    // a torn line is cut off, otherwise the next entry would be glued to it
+    off_t size = ::lseek(fd, 0, SEEK_END);
+    if (resume && size > 0) {
+        char last = '\n';
+        if (::pread(fd, &last, 1, size - 1) != 1 || last != '\n') {
+            std::ifstream in (this->journalPath, std::ios_base::in | std::ios_base::binary);
+            std::string content ((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+            auto complete = content.rfind('\n');
+            if (::ftruncate(fd, complete == std::string::npos ? 0 : static_cast<off_t>(complete + 1)) != 0) {
+                std::cerr << "WARN: Could not repair journal " << this->journalPath << ": " << std::strerror(errno) << std::endl;
+            }
+        }
+    }
+}
+
+JR::Journal::~Journal() {
+    flush();
+    if (fd >= 0) ::close(fd);
+}
+
+bool JR::Journal::isOpen() const {
+    return fd >= 0;
+}
+
+bool JR::Journal::contains(const std::string &path) const {
+    return done.contains(path);
+}
+
+void JR::Journal::record(const std::string &path) {
+    std::lock_guard lock(mutex);
+    pending.push_back(path);
+    recorded++;
+    if (pending.size() >= batchSize) flushLocked();
+}
+
+bool JR::Journal::flush() {
+    std::lock_guard lock(mutex);
+    return flushLocked();
+}
+
+bool JR::Journal::flushLocked() {
+    if (fd < 0 || pending.empty()) return fd >= 0;
+
+    std::string batch;
+    for (auto &path : pending) {
+        batch += OW::escapeTsv(path);
+        batch += '\n';
+    }
+    pending.clear();
+
+    // O_APPEND, a single write per batch keeps batches of concurrent runs from interleaving mid-line
+    std::size_t written = 0;
+    while (written < batch.size()) {
+        ssize_t n = ::write(fd, batch.data() + written, batch.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            std::cerr << "WARN: Could not write journal " << journalPath << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        written += n;
+    }
+    return ::fsync(fd) == 0;
+}
+
+std::size_t JR::Journal::loadedCount() const {
+    return done.size();
+}
+
+std::size_t JR::Journal::recordedCount() const {
+    std::lock_guard lock(mutex);
+    return recorded;
+}
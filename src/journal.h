@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace JR {
+    // one of count parts of the input, index is 1-based ("2/8" is the second of eight)
+    struct Shard {
+        unsigned int index = 1;
+        unsigned int count = 1;
+    };
+
+    // parse "I/N" with 1 <= I <= N
+    std::optional<Shard> parseShard(std::string_view value);
+
+    // whether path belongs to the shard, decided by a hash of the path alone
+    // so every machine running the same command over the same storage splits the files the same way
+    bool inShard(const std::string& path, const Shard &shard);
+
+    // fsync a file that was just saved, a file is only recorded once its save can't be lost anymore
+    // otherwise a power loss could leave the journal listing a file whose new tags never made it to disk
+    bool syncFile(const std::string& path);
+
+    // append-only list of files that were completely handled, one TSV-escaped path per line
+    // entries are collected in memory and written (and fsync-ed) in batches, so a crash loses at most the last batch,
+    // which is then simply done again
+    // a torn last line left by a crash is ignored on load
+    // safe to use from multiple threads
+    class Journal {
+    public:
+        // resume loads the files already in the journal and appends to it, otherwise the journal starts out empty
+        Journal(std::string journalPath, bool resume);
+        // flushes what's left
+        ~Journal();
+
+        Journal(const Journal &) = delete;
+        Journal &operator=(const Journal &) = delete;
+
+        bool isOpen() const;
+
+        // completed in an earlier run (only with resume)
+        bool contains(const std::string& path) const;
+        // mark path as completed, written with the next batch
+        void record(const std::string& path);
+        // write and fsync everything recorded so far, false on write errors
+        bool flush();
+
+        // files loaded from an earlier run and files recorded in this one
+        std::size_t loadedCount() const;
+        std::size_t recordedCount() const;
+
+    private:
+        bool flushLocked();
+
+        std::string journalPath;
+        int fd = -1;
+
+        // only written to while loading, read concurrently afterwards
+        std::unordered_set<std::string> done;
+
+        mutable std::mutex mutex;
+        std::vector<std::string> pending;
+        std::size_t recorded = 0;
+    };
+}
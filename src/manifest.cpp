@@ -0,0 +1,484 @@
+#include "manifest.h"
+
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+#include "file_handler.h"
+#include "output_writer.h"
+
+namespace {
+    std::string upper(std::string value) {
+        std::ranges::transform(value, value.begin(), [](unsigned char c) { return std::toupper(c); });
+        return value;
+    }
+
+    TagLib::String utf8(const std::string &value) {
+        return {value, TagLib::String::UTF8};
+    }
+
+    // split a PICTURE cell into paths, empty parts are dropped
+    std::vector<std::string> splitPictures(const std::string &cell) {
+        std::vector<std::string> result;
+        std::size_t start = 0;
+        while (start <= cell.size()) {
+            std::size_t end = cell.find(';', start);
+            if (end == std::string::npos) end = cell.size();
+            if (end > start) result.push_back(cell.substr(start, end - start));
+            start = end + 1;
+        }
+        return result;
+    }
+
+    // split a TSV cell on the unit separator (0x1F) read mode joins multiple values with
+    std::vector<std::string> splitValues(const std::string &cell) {
+        std::vector<std::string> result;
+        std::size_t start = 0;
+        while (true) {
+            std::size_t end = cell.find('\x1F', start);
+            result.push_back(cell.substr(start, end == std::string::npos ? std::string::npos : end - start));
+            if (end == std::string::npos) break;
+            start = end + 1;
+        }
+        return result;
+    }
+
+    // just enough JSON for manifest lines: objects, arrays, strings, and numbers/booleans kept as their text
+    struct JsonValue {
+        enum valueTypes { NUL, TEXT, ARRAY, OBJECT } type = NUL;
+        std::string text;
+        std::vector<JsonValue> items;
+        std::vector<std::pair<std::string, JsonValue>> members;
+    };
+
+    class JsonParser {
+    public:
+        explicit JsonParser(const std::string &input) : input(input) {}
+
+        // parse the whole input as one value, nullopt if it isn't valid
+        std::optional<JsonValue> parse() {
+            JsonValue value;
+            if (!parseValue(value)) return std::nullopt;
+            skipSpace();
+            if (pos != input.size()) return std::nullopt;
+            return value;
+        }
+
+    private:
+        void skipSpace() {
+            while (pos < input.size() && std::isspace(static_cast<unsigned char>(input[pos]))) pos++;
+        }
+
+        bool consume(char c) {
+            skipSpace();
+            if (pos < input.size() && input[pos] == c) {
+                pos++;
+                return true;
+            }
+            return false;
+        }
+
+        bool parseValue(JsonValue &value) {
+            skipSpace();
+            if (pos >= input.size()) return false;
+
+            switch (input[pos]) {
+                case '{': return parseObject(value);
+                case '[': return parseArray(value);
+                case '"':
+                    value.type = JsonValue::TEXT;
+                    return parseString(value.text);
+                default:
+                    return parseLiteral(value);
+            }
+        }
+
+        bool parseObject(JsonValue &value) {
+            value.type = JsonValue::OBJECT;
+            pos++;
+            if (consume('}')) return true;
+
+            do {
+                skipSpace();
+                std::string key;
+                if (pos >= input.size() || input[pos] != '"' || !parseString(key)) return false;
+                if (!consume(':')) return false;
+
+                JsonValue member;
+                if (!parseValue(member)) return false;
+                value.members.emplace_back(std::move(key), std::move(member));
+            } while (consume(','));
+
+            return consume('}');
+        }
+
+        bool parseArray(JsonValue &value) {
+            value.type = JsonValue::ARRAY;
+            pos++;
+            if (consume(']')) return true;
+
+            do {
+                JsonValue item;
+                if (!parseValue(item)) return false;
+                value.items.push_back(std::move(item));
+            } while (consume(','));
+
+            return consume(']');
+        }
+
+        // numbers, true, false and null
+        bool parseLiteral(JsonValue &value) {
+            std::size_t start = pos;
+            while (pos < input.size() && (std::isalnum(static_cast<unsigned char>(input[pos])) || input[pos] == '-' || input[pos] == '+' || input[pos] == '.')) {
+                pos++;
+            }
+            if (pos == start) return false;
+
+            std::string literal = input.substr(start, pos - start);
+            if (literal == "null") {
+                value.type = JsonValue::NUL;
+            } else if (literal == "true" || literal == "false" || std::isdigit(static_cast<unsigned char>(literal.back()))) {
+                value.type = JsonValue::TEXT;
+                value.text = std::move(literal);
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        bool parseHex4(unsigned int &codePoint) {
+            if (pos + 4 > input.size()) return false;
+            codePoint = 0;
+            for (int i = 0; i < 4; i++) {
+                char c = input[pos++];
+                codePoint <<= 4;
+                if (c >= '0' && c <= '9') codePoint |= c - '0';
+                else if (c >= 'a' && c <= 'f') codePoint |= c - 'a' + 10;
+                else if (c >= 'A' && c <= 'F') codePoint |= c - 'A' + 10;
+                else return false;
+            }
+            return true;
+        }
+
+        static void appendUtf8(std::string &out, unsigned int codePoint) {
+            if (codePoint < 0x80) {
+                out += static_cast<char>(codePoint);
+            } else if (codePoint < 0x800) {
+                out += static_cast<char>(0xC0 | (codePoint >> 6));
+                out += static_cast<char>(0x80 | (codePoint & 0x3F));
+            } else if (codePoint < 0x10000) {
+                out += static_cast<char>(0xE0 | (codePoint >> 12));
+                out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (codePoint & 0x3F));
+            } else {
+                out += static_cast<char>(0xF0 | (codePoint >> 18));
+                out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (codePoint & 0x3F));
+            }
+        }
+
+        bool parseString(std::string &out) {
+            pos++; // opening quote
+            while (pos < input.size()) {
+                char c = input[pos++];
+                if (c == '"') return true;
+                if (c != '\\') {
+                    out += c;
+                    continue;
+                }
+
+                if (pos >= input.size()) return false;
+                switch (char escaped = input[pos++]) {
+                    case '"': case '\\': case '/': out += escaped; break;
+                    case 'n': out += '\n'; break;
+                    case 'r': out += '\r'; break;
+                    case 't': out += '\t'; break;
+                    case 'b': out += '\b'; break;
+                    case 'f': out += '\f'; break;
+                    case 'u': {
+                        unsigned int codePoint;
+                        if (!parseHex4(codePoint)) return false;
+                        // characters outside the BMP come as a surrogate pair
+                        if (codePoint >= 0xD800 && codePoint < 0xDC00 && input.compare(pos, 2, "\\u") == 0) {
+                            pos += 2;
+                            unsigned int low;
+                            if (!parseHex4(low) || low < 0xDC00 || low > 0xDFFF) return false;
+                            codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+                        }
+                        appendUtf8(out, codePoint);
+                        break;
+                    }
+                    default: return false;
+                }
+            }
+            return false;
+        }
+
+        const std::string &input;
+        std::size_t pos = 0;
+    };
+
+    // a tag value of an NDJSON entry as a StringList, null and [] give an empty list (the tag gets removed)
+    bool toStringList(const JsonValue &value, TagLib::StringList &out) {
+        switch (value.type) {
+            case JsonValue::NUL: return true;
+            case JsonValue::TEXT:
+                out.append(utf8(value.text));
+                return true;
+            case JsonValue::ARRAY:
+                for (auto &item : value.items) {
+                    if (item.type != JsonValue::TEXT) return false;
+                    out.append(utf8(item.text));
+                }
+                return true;
+            default: return false;
+        }
+    }
+}
+
+MF::manifestFormat MF::formatOf(const std::string &path) {
+    std::string ext = upper(FH::getExtOf(path));
+    if (ext == ".CSV") return CSV;
+    if (ext == ".TSV") return TSV;
+    return NDJSON;
+}
+
+const std::string &MF::itemLabel(const Entry &entry) {
+    return entry.path;
+}
+
+MF::ManifestReader::ManifestReader(const std::string &path)
+    : in(path, std::ios_base::in | std::ios_base::binary), path(path), format(formatOf(path)) {
+}
+
+bool MF::ManifestReader::isOpen() const {
+    return in.is_open();
+}
+
+bool MF::ManifestReader::next(Entry &entry) {
+    while (true) {
+        entry = {};
+        if (!(format == NDJSON ? nextNdjson(entry) : nextCsv(entry))) return false;
+
+        auto [it, inserted] = seen.emplace(entry.path, entry.line);
+        if (inserted) return true;
+        std::cerr << "WARN: Manifest line " << entry.line << " lists " << entry.path << " again (first on line " << it->second << "), skipping it" << std::endl;
+    }
+}
+
+bool MF::ManifestReader::readRecord(std::vector<std::string> &fields) {
+    return format == TSV ? readTsvRecord(fields) : readCsvRecord(fields);
+}
+
+bool MF::ManifestReader::readTsvRecord(std::vector<std::string> &fields) {
+    fields.clear();
+
+    std::string line;
+    if (!std::getline(in, line)) return false;
+    lineNumber++;
+    if (!line.empty() && line.back() == '\r') line.pop_back();
+
+    // escaped tabs and newlines are never literal, so every tab separates a field
+    std::string_view rest = line;
+    while (true) {
+        auto end = rest.find('\t');
+        fields.push_back(OW::unescapeTsv(rest.substr(0, end)));
+        if (end == std::string_view::npos) break;
+        rest.remove_prefix(end + 1);
+    }
+    return true;
+}
+
+bool MF::ManifestReader::readCsvRecord(std::vector<std::string> &fields) {
+    fields.clear();
+
+    std::string line;
+    if (!std::getline(in, line)) return false;
+    lineNumber++;
+
+    std::string field;
+    bool quoted = false;
+    std::size_t i = 0;
+    while (true) {
+        if (i >= line.size()) {
+            if (!quoted) break;
+            // a quoted field goes on over the line break
+            field += '\n';
+            if (!std::getline(in, line)) break;
+            lineNumber++;
+            i = 0;
+            continue;
+        }
+
+        char c = line[i++];
+        if (quoted) {
+            if (c != '"') {
+                field += c;
+            } else if (i < line.size() && line[i] == '"') {
+                // "" is an escaped quote
+                field += '"';
+                i++;
+            } else {
+                quoted = false;
+            }
+        } else if (c == '"') {
+            quoted = true;
+        } else if (c == ',') {
+            fields.push_back(std::move(field));
+            field.clear();
+        } else if (c != '\r' || i < line.size()) {
+            // the \r of CRLF line endings is dropped
+            field += c;
+        }
+    }
+    fields.push_back(std::move(field));
+    return true;
+}
+
+bool MF::ManifestReader::readCsvHeader() {
+    headerRead = true;
+
+    std::vector<std::string> header;
+    if (!readRecord(header)) return false;
+
+    for (std::size_t i = 0; i < header.size(); i++) {
+        std::string key = upper(header[i]);
+        int type = TM::UNDEFINED;
+
+        if (key == "FILE" || key == "PATH") {
+            fileColumn = static_cast<int>(i);
+        } else if (key == "PICTURE") {
+            pictureColumn = static_cast<int>(i);
+        } else if (!key.empty()) {
+            type = TM::findPropTypeByKey(key);
+            if (type == TM::UNDEFINED) {
+                std::cerr << "WARN: Unknown tag key " << key << " in manifest " << path << " will be ignored" << std::endl;
+            }
+        }
+        columns.push_back(type);
+    }
+
+    if (fileColumn < 0) {
+        std::cerr << "Manifest " << path << " has no FILE column" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MF::ManifestReader::nextCsv(Entry &entry) {
+    if (!headerRead && !readCsvHeader()) return false;
+    if (fileColumn < 0) return false;
+
+    std::vector<std::string> fields;
+    while (true) {
+        entry.line = lineNumber + 1;
+        if (!readRecord(fields)) return false;
+
+        // blank lines are skipped
+        if (fields.size() == 1 && fields[0].empty()) continue;
+
+        if (fields.size() != columns.size()) {
+            std::cerr << "WARN: Manifest line " << entry.line << " has " << fields.size() << " columns instead of " << columns.size() << ", skipping it" << std::endl;
+            continue;
+        }
+
+        entry.path = FH::cleanPath(fields[fileColumn]);
+        if (entry.path.empty()) {
+            std::cerr << "WARN: Manifest line " << entry.line << " has no file, skipping it" << std::endl;
+            continue;
+        }
+
+        for (std::size_t i = 0; i < fields.size(); i++) {
+            if (columns[i] == TM::UNDEFINED || fields[i].empty()) continue;
+            if (format == TSV) {
+                // several values are joined with the unit separator, like read mode writes them
+                TagLib::StringList values;
+                for (auto &value : splitValues(fields[i])) values.append(utf8(value));
+                entry.batch.propLists[columns[i]] = values;
+            } else {
+                entry.batch.propLists[columns[i]] = TagLib::StringList(utf8(fields[i]));
+            }
+        }
+
+        if (pictureColumn >= 0 && !fields[pictureColumn].empty()) {
+            entry.batch.replacePictures = true;
+            entry.batch.pictures = splitPictures(fields[pictureColumn]);
+        }
+        return true;
+    }
+}
+
+bool MF::ManifestReader::nextNdjson(Entry &entry) {
+    std::string line;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        entry = {};
+        entry.line = lineNumber;
+
+        if (std::ranges::all_of(line, [](unsigned char c) { return std::isspace(c); })) continue;
+
+        auto value = JsonParser(line).parse();
+        if (!value || value->type != JsonValue::OBJECT) {
+            std::cerr << "WARN: Manifest line " << lineNumber << " is not a JSON object, skipping it" << std::endl;
+            continue;
+        }
+
+        bool valid = true;
+        auto addTag = [&](const std::string &key, const JsonValue &tagValue) {
+            int type = TM::findPropTypeByKey(upper(key));
+            if (type == TM::UNDEFINED) {
+                std::cerr << "WARN: Unknown tag key " << key << " on manifest line " << lineNumber << " will be ignored" << std::endl;
+                return;
+            }
+
+            TagLib::StringList values;
+            if (!toStringList(tagValue, values)) {
+                valid = false;
+                return;
+            }
+            entry.batch.propLists[type] = values;
+        };
+
+        for (auto &[key, member] : value->members) {
+            std::string name = upper(key);
+            if (name == "FILE" || name == "PATH") {
+                if (member.type == JsonValue::TEXT) entry.path = member.text;
+            } else if (name == "TAGS") {
+                if (member.type != JsonValue::OBJECT) {
+                    valid = false;
+                    continue;
+                }
+                for (auto &[tagKey, tagValue] : member.members) addTag(tagKey, tagValue);
+            } else if (name == "PICTURE" || name == "PICTURES") {
+                entry.batch.replacePictures = true;
+                if (member.type == JsonValue::TEXT) {
+                    entry.batch.pictures.push_back(member.text);
+                } else if (member.type == JsonValue::ARRAY) {
+                    for (auto &item : member.items) {
+                        if (item.type == JsonValue::TEXT) entry.batch.pictures.push_back(item.text);
+                        else valid = false;
+                    }
+                } else if (member.type != JsonValue::NUL) {
+                    valid = false;
+                }
+            } else {
+                addTag(key, member);
+            }
+        }
+
+        if (!valid) {
+            std::cerr << "WARN: Manifest line " << lineNumber << " has values that aren't text or lists of text, skipping it" << std::endl;
+            continue;
+        }
+        if (entry.path.empty()) {
+            std::cerr << "WARN: Manifest line " << lineNumber << " has no file, skipping it" << std::endl;
+            continue;
+        }
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tag_manager.h"
+
+namespace MF {
+    enum manifestFormat {
+        CSV,
+        TSV,
+        NDJSON
+    };
+
+    // .csv files are read as CSV, .tsv files as TSV, anything else (.ndjson, .jsonl ...) as NDJSON
+    manifestFormat formatOf(const std::string& path);
+
+    // the changes for one file listed in a manifest
+    struct Entry {
+        std::string path;
+        TM::EditBatch batch;
+        // line of the manifest the entry starts on, for messages
+        std::size_t line = 0;
+    };
+
+    // used by WP::forEachOrdered for error messages
+    const std::string &itemLabel(const Entry &entry);
+
+    // reads a manifest one entry at a time, so even huge manifests are never loaded as a whole
+    //
+    // CSV: the header row names the columns. FILE (or PATH) is the audio file, PICTURE holds image paths separated by ';',
+    // every other column is a tag key like on the command line (TITLE, TRACKNUMBER, ALBUMARTIST ...)
+    // empty cells leave the tag as it is
+    //
+    // TSV: the same columns, fields escaped and multiple values joined with 0x1F like the --format tsv output of read mode,
+    // so that output can be edited and applied again
+    //
+    // NDJSON: one object per line, {"file": "a.flac", "tags": {"TITLE": "x", "ARTIST": ["a", "b"]}, "pictures": ["cover.jpg"]}
+    // tag keys may also be written at the top level, numbers are taken as text, null or [] removes a tag
+    // and "pictures": [] removes every picture. This is the same layout read mode writes with --format ndjson
+    //
+    // listing pictures replaces all pictures embedded in the file, relative paths are relative to the working directory
+    // a file listed more than once only gets its first entry, the others are warned about and skipped
+    // (two entries for one file would be saved at the same time)
+    class ManifestReader {
+    public:
+        explicit ManifestReader(const std::string& path);
+
+        bool isOpen() const;
+
+        // read the next entry, malformed ones are reported on stderr and skipped
+        // false once the end of the manifest is reached
+        bool next(Entry &entry);
+
+    private:
+        bool nextCsv(Entry &entry);
+        bool nextNdjson(Entry &entry);
+        // CSV and TSV records
+        bool readRecord(std::vector<std::string> &fields);
+        bool readCsvRecord(std::vector<std::string> &fields);
+        bool readTsvRecord(std::vector<std::string> &fields);
+        bool readCsvHeader();
+
+        std::ifstream in;
+        std::string path;
+        manifestFormat format;
+        std::size_t lineNumber = 0;
+
+        // prop type of every CSV column, UNDEFINED for ignored ones
+        std::vector<int> columns;
+        int fileColumn = -1;
+        int pictureColumn = -1;
+        bool headerRead = false;
+
+        // manifest line of every file listed so far
+        std::unordered_map<std::string, std::size_t> seen;
+    };
+}
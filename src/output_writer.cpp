@@ -0,0 +1,175 @@
+#include "output_writer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <unistd.h>
+
+#include "tag_manager.h"
+
+OW::outputFormat OW::parseFormat(const std::string &name) {
+    if (name == "ndjson") return NDJSON;
+    if (name == "tsv") return TSV;
+    return TEXT;
+}
+
+std::string OW::escapeJson(std::string_view value) {
+    std::string result;
+    result.reserve(value.size());
+
+    for (char c : value) {
+        switch (c) {
+            case '"': result += "\\\""; break;
+            case '\\': result += "\\\\"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            case '\t': result += "\\t"; break;
+            case '\b': result += "\\b"; break;
+            case '\f': result += "\\f"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    // every other control character has to be written as a unicode escape
+                    char escaped[7];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned char>(c));
+                    result += escaped;
+                } else {
+                    // UTF-8 sequences can be passed through as they are
+                    result += c;
+                }
+        }
+    }
+    return result;
+}
+
+std::string OW::escapeTsv(std::string_view value) {
+    std::string result;
+    result.reserve(value.size());
+
+    for (char c : value) {
+        switch (c) {
+            case '\\': result += "\\\\"; break;
+            case '\t': result += "\\t"; break;
+            case '\n': result += "\\n"; break;
+            case '\r': result += "\\r"; break;
+            default: result += c;
+        }
+    }
+    return result;
+}
+
+std::string OW::unescapeTsv(std::string_view value) {
+    std::string result;
+    result.reserve(value.size());
+
+    for (std::size_t i = 0; i < value.size(); i++) {
+        if (value[i] != '\\' || i + 1 == value.size()) {
+            result += value[i];
+            continue;
+        }
+
+        switch (value[++i]) {
+            case 't': result += '\t'; break;
+            case 'n': result += '\n'; break;
+            case 'r': result += '\r'; break;
+            default: result += value[i];
+        }
+    }
+    return result;
+}
+
+std::vector<int> OW::sortedColumns(const std::unordered_set<int> &props) {
+    std::vector<int> result (props.begin(), props.end());
+    std::ranges::sort(result);
+    return result;
+}
+
+void OW::writeTsvHeader(std::ostream &out, const std::vector<int> &columns) {
+    out << "FILE";
+    for (int type : columns) {
+        out << '\t' << TM::propKeys.at(type);
+    }
+    out << '\n';
+}
+
+void OW::writeRecord(std::ostream &out, outputFormat format, const std::string &path,
+                     const std::map<int, TagLib::StringList> &props, const std::vector<int> &tsvColumns) {
+    if (format == NDJSON) {
+        out << "{\"file\":\"" << escapeJson(path) << "\",\"tags\":{";
+
+        bool firstTag = true;
+        for (auto &[type, values] : props) {
+            if (!firstTag) out << ',';
+            firstTag = false;
+
+            out << '"' << TM::propKeys.at(type) << "\":[";
+            bool firstValue = true;
+            for (auto &value : values) {
+                if (!firstValue) out << ',';
+                firstValue = false;
+                out << '"' << escapeJson(value.to8Bit(true)) << '"';
+            }
+            out << ']';
+        }
+        out << "}}\n";
+    } else if (format == TSV) {
+        out << escapeTsv(path);
+
+        for (int type : tsvColumns) {
+            out << '\t';
+            auto it = props.find(type);
+            if (it == props.end()) continue;
+
+            bool firstValue = true;
+            for (auto &value : it->second) {
+                if (!firstValue) out << '\x1f';
+                firstValue = false;
+                out << escapeTsv(value.to8Bit(true));
+            }
+        }
+        out << '\n';
+    }
+}
+
+OW::FdStreamBuf::FdStreamBuf(int fd, std::size_t bufferSize) : fd(fd), buffer(bufferSize) {
+    setp(buffer.data(), buffer.data() + buffer.size());
+}
+
+OW::FdStreamBuf::~FdStreamBuf() {
+    flushBuffer();
+}
+
+OW::FdStreamBuf::int_type OW::FdStreamBuf::overflow(int_type ch) {
+    if (!flushBuffer()) return traits_type::eof();
+
+    if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+    }
+    return traits_type::not_eof(ch);
+}
+
+int OW::FdStreamBuf::sync() {
+    return flushBuffer() ? 0 : -1;
+}
+
+bool OW::FdStreamBuf::flushBuffer() {
+    const char *data = pbase();
+    std::size_t remaining = pptr() - pbase();
+
+    while (remaining > 0) {
+        ssize_t written = ::write(fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        remaining -= written;
+    }
+
+    setp(buffer.data(), buffer.data() + buffer.size());
+    return true;
+}
+
+OW::BufferedOutput::BufferedOutput(int fd, std::size_t bufferSize) : std::ostream(nullptr), buf(fd, bufferSize) {
+    rdbuf(&buf);
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <tstringlist.h>
+#include <unordered_set>
+#include <vector>
+
+namespace OW {
+    // how read results are printed
+    enum outputFormat : int {
+        TEXT,   // human readable, the original format
+        NDJSON, // one JSON object per file and line
+        TSV     // header line with the tag keys, then one tab separated row per file
+    };
+
+    // parse the --format value, unknown names fall back to TEXT
+    outputFormat parseFormat(const std::string& name);
+
+    // escape a value for use inside a JSON string (without the surrounding quotes)
+    std::string escapeJson(std::string_view value);
+
+    // escape a value for a TSV field - backslash, tab, newline and carriage return become \\, \t, \n and \r
+    std::string escapeTsv(std::string_view value);
+
+    // undo escapeTsv
+    std::string unescapeTsv(std::string_view value);
+
+    // the TSV header line for the given columns (propTypes, in order)
+    void writeTsvHeader(std::ostream &out, const std::vector<int> &columns);
+
+    // write the read properties of one file as a single NDJSON or TSV record
+    // multiple values of one tag become a JSON array, or are joined with the unit separator (0x1F) in TSV
+    void writeRecord(std::ostream &out, outputFormat format, const std::string& path,
+                     const std::map<int, TagLib::StringList> &props, const std::vector<int> &tsvColumns);
+
+    // the requested propTypes in a stable order to be used as TSV columns
+    std::vector<int> sortedColumns(const std::unordered_set<int> &props);
+
+    // stream buffer writing straight to a file descriptor through a large buffer
+    // it only writes when the buffer is full or on an explicit flush, never per line
+    class FdStreamBuf : public std::streambuf {
+    public:
+        explicit FdStreamBuf(int fd, std::size_t bufferSize = 1 << 20);
+        ~FdStreamBuf() override;
+
+    protected:
+        int_type overflow(int_type ch) override;
+        int sync() override;
+
+    private:
+        bool flushBuffer();
+
+        int fd;
+        std::vector<char> buffer;
+    };
+
+    // std::ostream over an FdStreamBuf
+    class BufferedOutput : public std::ostream {
+    public:
+        explicit BufferedOutput(int fd, std::size_t bufferSize = 1 << 20);
+
+    private:
+        FdStreamBuf buf;
+    };
+}
@@ -0,0 +1,112 @@
+#include "picture_extractor.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <iostream>
+
+#include "file_handler.h"
+#include "image_store.h"
+#include "output_writer.h"
+#include "tag_manager.h"
+
+namespace fs = std::filesystem;
+
+PE::PictureExtractor::PictureExtractor(std::string targetDir, const std::string &manifestPath, bool hardlink)
+    : targetDir(std::move(targetDir)), hardlink(hardlink), jobs(256) {
+    fs::create_directories(this->targetDir);
+
+    std::string manifestFile = manifestPath.empty() ? (fs::path(this->targetDir) / "manifest.ndjson").string() : manifestPath;
+    manifest.open(manifestFile, std::ios_base::out | std::ios_base::trunc);
+    if (!manifest) {
+        std::cerr << "Could not create picture manifest " << manifestFile << std::endl;
+    }
+
+    writer = std::thread(&PictureExtractor::runWriter, this);
+}
+
+PE::PictureExtractor::~PictureExtractor() {
+    finish();
+}
+
+bool PE::PictureExtractor::extract(const TagLib::FileRef &f, const std::string &path) {
+    std::string manifestLine = "{\"file\":\"" + OW::escapeJson(path) + "\",\"images\":[";
+    int imgIdx = 0;
+
+    for (auto &img : TM::getImgTags(f)) {
+        pictures++;
+
+        std::uint64_t hash = IS::hashBytes(img.data.data(), img.data.size());
+        std::string storedName;
+        {
+            std::lock_guard lock(seenMutex);
+            auto [it, inserted] = seen.try_emplace({hash, img.data.size()});
+            if (inserted) {
+                // the size is part of the name as well as the key, pictures that only share a hash don't overwrite each other
+                char name[40];
+                std::snprintf(name, sizeof(name), "%016llx-%zu", static_cast<unsigned long long>(hash), static_cast<std::size_t>(img.data.size()));
+                it->second = name + TM::imgExtensionOf(img.mimeType);
+            }
+            storedName = it->second;
+
+            // only the first file carrying a picture writes it, the data itself is shared, not copied
+            // queued while still holding the lock, so no other thread can queue a link to the picture before it
+            if (inserted) {
+                unique++;
+                if (!jobs.push({WriteJob::IMAGE, img.data, (fs::path(targetDir) / storedName).string(), ""})) return false;
+            }
+        }
+
+        if (hardlink) {
+            // the image job of the same picture is always queued before, so the link source exists already
+            std::string storedPath = (fs::path(targetDir) / storedName).string();
+            if (!jobs.push({WriteJob::LINK, {}, TM::imgExportName(path, imgIdx, img.mimeType), storedPath})) return false;
+        }
+
+        if (imgIdx > 0) manifestLine += ',';
+        manifestLine += "\"" + OW::escapeJson(storedName) + "\"";
+        imgIdx++;
+    }
+
+    manifestLine += "]}\n";
+    return jobs.push({WriteJob::MANIFEST, {}, "", manifestLine});
+}
+
+void PE::PictureExtractor::finish() {
+    if (finished) return;
+    finished = true;
+
+    jobs.close();
+    writer.join();
+    manifest.close();
+}
+
+std::size_t PE::PictureExtractor::pictureCount() const {
+    return pictures;
+}
+
+std::size_t PE::PictureExtractor::uniqueCount() const {
+    return unique;
+}
+
+void PE::PictureExtractor::runWriter() {
+    WriteJob job;
+    while (jobs.pop(job)) {
+        switch (job.type) {
+            case WriteJob::IMAGE:
+                FH::exportFile(job.data, job.target);
+                break;
+            case WriteJob::LINK: {
+                std::error_code ec;
+                fs::remove(job.target, ec);
+                fs::create_hard_link(job.text, job.target, ec);
+                // hardlinks don't work across filesystems, a copy is the next best thing
+                if (ec) fs::copy_file(job.text, job.target, fs::copy_options::overwrite_existing, ec);
+                if (ec) std::cerr << "Could not link picture " << job.target << ": " << ec.message() << std::endl;
+                break;
+            }
+            case WriteJob::MANIFEST:
+                manifest << job.text;
+                break;
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <fileref.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include "work_pool.h"
+
+namespace PE {
+    // bulk picture extraction that writes every distinct picture only once
+    // pictures are hashed and stored in targetDir as <hash>-<size><ext>, a manifest (NDJSON, one line per audio file)
+    // lists which stored pictures belong to which file
+    // the actual writing happens on a background thread, so parsing the next files isn't held up by disk writes
+    class PictureExtractor {
+    public:
+        // with hardlink set, the usual per-file picture names next to each audio file (see TM::imgExportName)
+        // are created too, as hardlinks to the stored picture instead of separate copies
+        PictureExtractor(std::string targetDir, const std::string& manifestPath, bool hardlink);
+        ~PictureExtractor();
+
+        PictureExtractor(const PictureExtractor &) = delete;
+        PictureExtractor &operator=(const PictureExtractor &) = delete;
+
+        // hash the pictures of f and queue the new ones for writing, safe to call from multiple threads
+        bool extract(const TagLib::FileRef &f, const std::string& path);
+
+        // wait until everything queued is written
+        void finish();
+
+        std::size_t pictureCount() const;
+        std::size_t uniqueCount() const;
+
+    private:
+        struct WriteJob {
+            enum jobTypes { IMAGE, LINK, MANIFEST } type;
+            TagLib::ByteVector data;
+            std::string target;
+            std::string text; // link source or manifest line
+        };
+
+        void runWriter();
+
+        std::string targetDir;
+        bool hardlink;
+        std::ofstream manifest;
+
+        // (content hash, size) -> stored filename
+        std::mutex seenMutex;
+        std::map<std::pair<std::uint64_t, std::size_t>, std::string> seen;
+
+        std::atomic<std::size_t> pictures = 0;
+        std::atomic<std::size_t> unique = 0;
+
+        WP::BoundedQueue<WriteJob> jobs;
+        std::thread writer;
+        bool finished = false;
+    };
+}
@@ -0,0 +1,64 @@
+#include "prefetcher.h"
+
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "stats.h"
+
+PF::Prefetcher::Prefetcher(WP::ItemSource source, PrefetchOptions options)
+    : source(std::move(source)), options(options), pool(threadsFor(options.depth)) {
+}
+
+bool PF::Prefetcher::next(std::string &file) {
+    std::lock_guard lock(mutex);
+
+    // keep the window full, every file is prefetched once when it enters it
+    while (!sourceDone && window.size() <= options.depth) {
+        std::string upcoming;
+        if (!source(upcoming)) {
+            sourceDone = true;
+            break;
+        }
+        pool.submit([this, upcoming, sequence = queuedCount++] {
+            // the parser already has this file, prefetching it now would only compete with it
+            if (sequence < handedOut) return;
+            prefetch(upcoming);
+        });
+        window.push_back(std::move(upcoming));
+    }
+
+    if (window.empty()) return false;
+    file = std::move(window.front());
+    window.pop_front();
+    handedOut++;
+    return true;
+}
+
+void PF::Prefetcher::prefetch(const std::string &file) const {
+#if defined(POSIX_FADV_WILLNEED)
+    int fd = ::open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+
+    struct stat st {};
+    if (::fstat(fd, &st) == 0) {
+        auto size = static_cast<std::uint64_t>(st.st_size);
+        auto head = std::min(size, options.headBytes);
+        ::posix_fadvise(fd, 0, static_cast<off_t>(head), POSIX_FADV_WILLNEED);
+
+        // the tail only if it doesn't overlap the head
+        auto tail = std::min(size - head, options.tailBytes);
+        if (tail > 0) ::posix_fadvise(fd, static_cast<off_t>(size - tail), static_cast<off_t>(tail), POSIX_FADV_WILLNEED);
+        ST::count(ST::FILES_PREFETCHED);
+    }
+    ::close(fd);
+#else
+    (void) file;
+#endif
+}
+
+unsigned int PF::threadsFor(std::size_t depth) {
+    // a pool of one would run every prefetch inline, on the thread waiting for the next file
+    return static_cast<unsigned int>(std::clamp<std::size_t>(depth / 4, 2, 16));
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+
+#include "work_pool.h"
+
+namespace PF {
+    struct PrefetchOptions {
+        // files prefetched ahead of the one being handed out, 0 turns prefetching off
+        std::size_t depth = 0;
+        // bytes from the start of each file, where ID3v2, FLAC, Ogg and most MP4 tags are
+        std::uint64_t headBytes = 256 * 1024;
+        // bytes from the end of each file, for ID3v1, APE and MP4 files with the moov atom at the end
+        std::uint64_t tailBytes = 64 * 1024;
+    };
+
+    // sits between the input files and the processing loop and looks ahead in the list
+    // every file entering the look-ahead window is opened on a few background threads and its tag regions
+    // are handed to the kernel with posix_fadvise(WILLNEED), which starts reading them without waiting for the data
+    // by the time the parser opens the file its pages are (being) read already, so on cold disks and network
+    // storage the reads of many files overlap instead of paying the full latency for each file in turn
+    //
+    // memory stays bounded: at most depth files are ahead, each with at most headBytes + tailBytes of page cache
+    class Prefetcher {
+    public:
+        Prefetcher(WP::ItemSource source, PrefetchOptions options);
+
+        // the next file of source, in the same order, false once source has no more
+        // safe to call from multiple threads
+        bool next(std::string &file);
+
+    private:
+        void prefetch(const std::string &file) const;
+
+        WP::ItemSource source;
+        PrefetchOptions options;
+
+        std::mutex mutex;
+        std::deque<std::string> window;
+        bool sourceDone = false;
+        // files that entered the window and files that left it, prefetches that fall behind are skipped
+        std::size_t queuedCount = 0;
+        std::atomic<std::size_t> handedOut = 0;
+
+        // opening a file is a round trip too, so several are opened at once
+        WP::WorkPool pool;
+    };
+
+    // threads used for a look-ahead depth
+    unsigned int threadsFor(std::size_t depth);
+}
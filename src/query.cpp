@@ -0,0 +1,204 @@
+#include "query.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "tag_manager.h"
+
+namespace {
+    // longest operators first, so <= isn't read as <
+    constexpr std::pair<std::string_view, QY::operatorTypes> operatorTokens[] = {
+        {"!=", QY::NOT_EQUAL},
+        {"^=", QY::PREFIX},
+        {"~=", QY::REGEX},
+        {"<=", QY::LESS_EQUAL},
+        {">=", QY::GREATER_EQUAL},
+        {"=", QY::EQUAL},
+        {"<", QY::LESS},
+        {">", QY::GREATER},
+    };
+
+    bool isNumeric(QY::operatorTypes op) {
+        return op == QY::LESS || op == QY::LESS_EQUAL || op == QY::GREATER || op == QY::GREATER_EQUAL;
+    }
+
+    bool compareNumber(const QY::Condition &condition, double number) {
+        // NaN compares false to everything, so values without a number never match
+        switch (condition.op) {
+            case QY::LESS: return number < condition.number;
+            case QY::LESS_EQUAL: return number <= condition.number;
+            case QY::GREATER: return number > condition.number;
+            case QY::GREATER_EQUAL: return number >= condition.number;
+            default: return false;
+        }
+    }
+
+    // the test of a single non-empty value, NOT_EQUAL is handled as "no value is EQUAL" by the callers
+    bool testValue(const QY::Condition &condition, std::string_view value, double number) {
+        switch (condition.op) {
+            case QY::EQUAL:
+            case QY::NOT_EQUAL: return value == condition.value;
+            case QY::PREFIX: return value.starts_with(condition.value);
+            case QY::REGEX: return std::regex_search(value.begin(), value.end(), *condition.regex);
+            default: return compareNumber(condition, number);
+        }
+    }
+
+    // the row result from whether any value passed testValue and whether the row has values at all
+    bool rowResult(const QY::Condition &condition, bool anyPassed, bool hasValues) {
+        if (condition.value.empty() && condition.op == QY::EQUAL) return !hasValues;
+        if (condition.value.empty() && condition.op == QY::NOT_EQUAL) return hasValues;
+        return condition.op == QY::NOT_EQUAL ? !anyPassed : anyPassed;
+    }
+}
+
+std::unordered_set<int> QY::Query::types() const {
+    std::unordered_set<int> result;
+    for (auto &condition : conditions) result.insert(condition.type);
+    return result;
+}
+
+QY::Condition QY::parseCondition(std::string_view expression) {
+    auto opStart = expression.find_first_of("!^~<>=");
+    if (opStart == std::string_view::npos || opStart == 0) {
+        throw std::invalid_argument("Expected KEY<operator>VALUE in condition " + std::string(expression));
+    }
+
+    std::string key (expression.substr(0, opStart));
+    std::ranges::transform(key, key.begin(), [](unsigned char c) { return std::toupper(c); });
+
+    Condition condition;
+    condition.type = TM::findPropTypeByKey(key);
+    if (condition.type == TM::UNDEFINED) {
+        throw std::invalid_argument("Unknown tag key " + key + " in condition " + std::string(expression));
+    }
+
+    auto rest = expression.substr(opStart);
+    auto token = std::ranges::find_if(operatorTokens, [rest](auto &entry) { return rest.starts_with(entry.first); });
+    if (token == std::end(operatorTokens)) {
+        throw std::invalid_argument("Unknown operator in condition " + std::string(expression));
+    }
+    condition.op = token->second;
+    condition.value = rest.substr(token->first.size());
+
+    if (isNumeric(condition.op)) {
+        auto number = leadingNumber(condition.value);
+        if (!number) throw std::invalid_argument("Expected a number in condition " + std::string(expression));
+        condition.number = *number;
+    } else if (condition.op == REGEX) {
+        try {
+            condition.regex.emplace(condition.value, std::regex::ECMAScript | std::regex::optimize);
+        } catch (const std::regex_error &e) {
+            throw std::invalid_argument("Invalid regex in condition " + std::string(expression) + ": " + e.what());
+        }
+    }
+    return condition;
+}
+
+QY::Query QY::parseQuery(const std::vector<std::string> &expressions) {
+    Query query;
+    for (auto &expression : expressions) query.conditions.push_back(parseCondition(expression));
+    return query;
+}
+
+std::optional<double> QY::leadingNumber(std::string_view value) {
+    while (!value.empty() && std::isspace(static_cast<unsigned char>(value.front()))) value.remove_prefix(1);
+    if (value.starts_with('+')) value.remove_prefix(1);
+
+    double result;
+    auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+    if (ec != std::errc()) return std::nullopt;
+    return result;
+}
+
+bool QY::matches(const Query &query, const std::map<int, TagLib::StringList> &props) {
+    const TagLib::StringList empty;
+
+    for (auto &condition : query.conditions) {
+        auto found = props.find(condition.type);
+        const TagLib::StringList &values = found != props.end() ? found->second : empty;
+
+        bool anyPassed = false;
+        bool hasValues = false;
+        for (auto &value : values) {
+            if (value.isEmpty()) continue;
+            hasValues = true;
+
+            std::string utf8 = value.to8Bit(true);
+            double number = isNumeric(condition.op)
+                ? leadingNumber(utf8).value_or(std::numeric_limits<double>::quiet_NaN())
+                : 0;
+            if (testValue(condition, utf8, number)) {
+                anyPassed = true;
+                break;
+            }
+        }
+
+        if (!rowResult(condition, anyPassed, hasValues)) return false;
+    }
+    return true;
+}
+
+void QY::Table::clear() {
+    paths.clear();
+    columns.clear();
+}
+
+std::size_t QY::Table::add(const std::string &path, const std::map<int, TagLib::StringList> &props) {
+    if (columns.empty()) columns.resize(TM::PROP_COUNT);
+
+    std::size_t row = paths.size();
+    paths.push_back(path);
+
+    for (auto &[type, values] : props) {
+        if (type < 0 || type >= TM::PROP_COUNT) continue;
+        Column &column = columns[type];
+        // rows without this tag are filled in here, so offsets always has one entry per row (plus one)
+        std::uint32_t filled = column.offsets.back();
+        column.offsets.resize(row + 1, filled);
+
+        for (auto &value : values) {
+            if (value.isEmpty()) continue;
+            column.values.push_back(value.to8Bit(true));
+            column.numbers.push_back(leadingNumber(column.values.back()).value_or(std::numeric_limits<double>::quiet_NaN()));
+        }
+        column.offsets.push_back(column.values.size());
+    }
+    return row;
+}
+
+std::vector<std::uint32_t> QY::Table::select(const Query &query) const {
+    std::vector<std::uint32_t> rows (paths.size());
+    for (std::uint32_t row = 0; row < rows.size(); row++) rows[row] = row;
+
+    // every condition narrows down the rows that are left
+    for (auto &condition : query.conditions) {
+        if (rows.empty()) break;
+        filter(condition, rows);
+    }
+    return rows;
+}
+
+void QY::Table::filter(const Condition &condition, std::vector<std::uint32_t> &rows) const {
+    static const Column emptyColumn;
+    const Column &column = columns.empty() ? emptyColumn : columns[condition.type];
+    const bool numeric = isNumeric(condition.op);
+
+    std::erase_if(rows, [&](std::uint32_t row) {
+        // columns only get offsets up to the last row that has the tag
+        std::uint32_t begin = row + 1 < column.offsets.size() ? column.offsets[row] : column.offsets.back();
+        std::uint32_t end = row + 1 < column.offsets.size() ? column.offsets[row + 1] : column.offsets.back();
+
+        bool anyPassed = false;
+        for (std::uint32_t i = begin; i < end && !anyPassed; i++) {
+            anyPassed = numeric
+                ? compareNumber(condition, column.numbers[i])
+                : testValue(condition, column.values[i], column.numbers[i]);
+        }
+        return !rowResult(condition, anyPassed, begin != end);
+    });
+}
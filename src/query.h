@@ -0,0 +1,85 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <tstringlist.h>
+#include <unordered_set>
+#include <vector>
+
+namespace QY {
+    enum operatorTypes : int {
+        EQUAL,          // KEY=VALUE, KEY= matches files without the tag
+        NOT_EQUAL,      // KEY!=VALUE, KEY!= matches files that have the tag
+        PREFIX,         // KEY^=VALUE
+        REGEX,          // KEY~=REGEX, searched in each value (ECMAScript syntax)
+        LESS,           // KEY<NUMBER, the number a value starts with, so 2001-05-04 is 2001 and 3/12 is 3
+        LESS_EQUAL,     // KEY<=NUMBER
+        GREATER,        // KEY>NUMBER
+        GREATER_EQUAL,  // KEY>=NUMBER
+    };
+
+    // one test against the values of one tag, a file with several values matches if any of them does
+    // (NOT_EQUAL only if none of them is equal)
+    struct Condition {
+        int type;
+        operatorTypes op;
+        std::string value;
+        double number = 0;
+        std::optional<std::regex> regex;
+    };
+
+    // all conditions have to match
+    struct Query {
+        std::vector<Condition> conditions;
+
+        bool empty() const { return conditions.empty(); }
+        // propTypes the conditions look at, these have to be read to evaluate the query
+        std::unordered_set<int> types() const;
+    };
+
+    // parse "KEY<op>VALUE", keys are matched case-insensitively
+    // throws std::invalid_argument for unknown keys, missing operators, bad numbers or regexes
+    Condition parseCondition(std::string_view expression);
+    Query parseQuery(const std::vector<std::string> &expressions);
+
+    // the number a tag value starts with, if any
+    std::optional<double> leadingNumber(std::string_view value);
+
+    // evaluate the query on the properties of one file, the props need to contain at least query.types()
+    bool matches(const Query &query, const std::map<int, TagLib::StringList> &props);
+
+    // the properties of many files stored column by column, so a query is a scan over each column it uses
+    // instead of a lookup per file and tag
+    // each column keeps all values of all rows back to back, with the numbers they start with next to them
+    class Table {
+    public:
+        void clear();
+        // appends a row, returns its index
+        std::size_t add(const std::string &path, const std::map<int, TagLib::StringList> &props);
+
+        std::size_t size() const { return paths.size(); }
+        const std::string &path(std::size_t row) const { return paths[row]; }
+
+        // indexes of all matching rows, in the order they were added
+        std::vector<std::uint32_t> select(const Query &query) const;
+
+    private:
+        struct Column {
+            // values of row r are values[offsets[r]] to values[offsets[r + 1]]
+            std::vector<std::uint32_t> offsets {0};
+            std::vector<std::string> values;
+            // NaN for values that don't start with a number
+            std::vector<double> numbers;
+        };
+
+        // keeps only the rows of rows that match condition
+        void filter(const Condition &condition, std::vector<std::uint32_t> &rows) const;
+
+        std::vector<std::string> paths;
+        std::vector<Column> columns;
+    };
+}
@@ -0,0 +1,151 @@
+#include "session.h"
+
+#include "fast_reader.h"
+#include "stats.h"
+
+ES::Session::Session(SessionOptions options) : options(std::move(options)) {
+    if (!this->options.indexPath.empty()) tagIndex = std::make_unique<TI::TagIndex>(this->options.indexPath);
+}
+
+ES::Session::~Session() {
+    // tasks still running could still update the index
+    pool.reset();
+    saveIndex();
+}
+
+ES::ReadResult ES::Session::readFile(const std::string &path, const std::unordered_set<int> *props, bool openFile) {
+    ReadResult result;
+    result.path = path;
+
+    // stat before parsing, so a file changing while it's being read can't be indexed with a newer stamp
+    TI::FileStamp stamp;
+    bool stamped = tagIndex && TI::statFile(path, stamp);
+
+    // unchanged files are answered straight from the index without opening them
+    if (stamped && !openFile) {
+        if (auto indexed = tagIndex->lookup(path, stamp)) {
+            result.ok = true;
+            result.fromIndex = true;
+            result.props = props ? TM::selectProps(*indexed, *props) : std::move(*indexed);
+            return result;
+        }
+    }
+
+    // the tag block of the common formats is parsed directly, only reading the bytes of the tag itself
+    // one sample per file, whether it took the fast reader, the FileRef or both
+    ST::Timer parseTimer (ST::PARSE);
+    std::optional<TagLib::PropertyMap> propMap;
+    if (!openFile) propMap = FR::readTagProps(path);
+
+    if (!propMap) {
+        // the fileref constructor doesn't take std::string directly, only char*, so .data is used
+        // audio properties are never used here, so they're not read at all (tags only)
+        result.file.emplace(path.data(), false);
+        if (result.file->isNull()) {
+            ST::count(ST::FILES_UNSUPPORTED);
+            result.file.reset();
+            return result;
+        }
+        propMap = result.file->properties();
+    }
+    parseTimer.stop();
+    ST::count(ST::FILES_PARSED);
+    result.ok = true;
+
+    if (stamped) {
+        // the index always stores every defined property, so any later request can be answered from it
+        auto allProps = TM::readAllProps(*propMap);
+        tagIndex->update(path, stamp, allProps);
+        result.props = props ? TM::selectProps(allProps, *props) : std::move(allProps);
+    } else {
+        result.props = props ? TM::readProps(*propMap, *props) : TM::readAllProps(*propMap);
+    }
+    return result;
+}
+
+ES::WriteResult ES::Session::writeFile(const std::string &path, const TM::EditBatch &batch, bool dryRun) {
+    WriteResult result;
+    result.path = path;
+
+    ST::Timer parseTimer (ST::PARSE);
+    TagLib::FileRef f (path.data());
+    parseTimer.stop();
+    if (f.isNull()) {
+        ST::count(ST::FILES_UNSUPPORTED);
+        return result;
+    }
+    ST::count(ST::FILES_PARSED);
+    result.opened = true;
+
+    // files that already have every requested value are only read, not saved again
+    result.diff = TM::diffEdits(f, batch);
+    if (dryRun) {
+        result.result = result.diff.empty() ? TM::COMMIT_UNCHANGED : TM::planCommit(f, batch, result.diff);
+        result.props = TM::readAllProps(f);
+        return result;
+    }
+
+    result.result = TM::commitEdits(f, batch, result.diff);
+    result.props = TM::readAllProps(f);
+
+    // the file was just saved, so its entry is refreshed with the new stamp
+    if (TI::FileStamp stamp; result.result && tagIndex && TI::statFile(path, stamp)) {
+        tagIndex->update(path, stamp, result.props);
+    }
+    return result;
+}
+
+std::vector<ES::ReadResult> ES::Session::read(std::span<const std::string> paths, const std::unordered_set<int> *props) {
+    std::vector<ReadResult> results (paths.size());
+    // pool.wait() waits for every task of the pool, so batches take turns
+    std::lock_guard lock(batchMutex);
+    WP::WorkPool &pool = workers();
+    for (std::size_t i = 0; i < paths.size(); i++) {
+        pool.submit([this, &results, &paths, props, i] { results[i] = readFile(paths[i], props); });
+    }
+    pool.wait();
+    return results;
+}
+
+std::vector<ES::WriteResult> ES::Session::write(std::span<const WriteRequest> requests, bool dryRun) {
+    std::vector<WriteResult> results (requests.size());
+    // pool.wait() waits for every task of the pool, so batches take turns
+    std::lock_guard lock(batchMutex);
+    WP::WorkPool &pool = workers();
+    for (std::size_t i = 0; i < requests.size(); i++) {
+        pool.submit([this, &results, &requests, dryRun, i] {
+            results[i] = writeFile(requests[i].path, requests[i].batch, dryRun);
+        });
+    }
+    pool.wait();
+    return results;
+}
+
+void ES::Session::writeResults(std::ostream &out, std::span<const ReadResult> results, OW::outputFormat format, const std::vector<int> &columns) const {
+    if (format == OW::TSV) OW::writeTsvHeader(out, columns);
+
+    for (auto &result : results) {
+        if (!result.ok) continue;
+        if (format != OW::TEXT) {
+            OW::writeRecord(out, format, result.path, result.props, columns);
+            continue;
+        }
+        out << "Properties of file: " << result.path << std::endl;
+        TM::printProps(result.props, out);
+        out << std::endl;
+    }
+}
+
+TI::TagIndex *ES::Session::index() const {
+    return tagIndex.get();
+}
+
+bool ES::Session::saveIndex() {
+    return !tagIndex || tagIndex->save();
+}
+
+WP::WorkPool &ES::Session::workers() {
+    // batchMutex is held by the caller
+    if (!pool) pool = std::make_unique<WP::WorkPool>(WP::resolveJobCount(options.jobs));
+    return *pool;
+}
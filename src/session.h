@@ -0,0 +1,99 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <fileref.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <tstringlist.h>
+#include <unordered_set>
+#include <vector>
+
+#include "output_writer.h"
+#include "tag_index.h"
+#include "tag_manager.h"
+#include "work_pool.h"
+
+namespace ES {
+    struct SessionOptions {
+        // files handled at the same time by the batch calls, 0 uses one per CPU thread
+        unsigned int jobs = 1;
+        // tag index kept for the whole session (see TI::TagIndex), none if empty
+        std::string indexPath;
+    };
+
+    struct ReadResult {
+        std::string path;
+        // false if the file couldn't be opened or isn't supported, props is empty then
+        bool ok = false;
+        bool fromIndex = false;
+        // every requested propType (empty if missing), or every defined one
+        std::map<int, TagLib::StringList> props;
+        // only with openFile, for anything that needs TagLib itself (e.g. extracting pictures)
+        std::optional<TagLib::FileRef> file;
+    };
+
+    struct WriteRequest {
+        std::string path;
+        TM::EditBatch batch;
+    };
+
+    struct WriteResult {
+        std::string path;
+        // false if the file couldn't be opened or isn't supported
+        bool opened = false;
+        // what the save did, or with a dry run what it would do (COMMIT_FAILED if it failed)
+        TM::commitResults result = TM::COMMIT_FAILED;
+        TM::EditDiff diff;
+        // every defined property after the save
+        std::map<int, TagLib::StringList> props;
+    };
+
+    // everything epictagmanager does to files, usable in-process without going through the command line
+    // a session keeps its tag index and worker threads for its whole lifetime, so calls after the first
+    // don't set anything up again; images to embed are cached process-wide by the image store
+    //
+    // single-file calls are safe to make from multiple threads at once, batch calls run on the session's
+    // own pool and return results in the order of their input
+    // batch calls from several threads are run one after the other
+    class Session {
+    public:
+        explicit Session(SessionOptions options = {});
+        // saves the index
+        ~Session();
+
+        Session(const Session &) = delete;
+        Session &operator=(const Session &) = delete;
+
+        // tags of one file: from the index if it didn't change since, otherwise from the fast tag reader,
+        // falling back to a tags-only FileRef
+        // props null reads every defined property, openFile skips the index and fast reader and keeps the FileRef
+        ReadResult readFile(const std::string& path, const std::unordered_set<int> *props = nullptr, bool openFile = false);
+
+        // diff the batch against the file and save it once if anything changes, dryRun only plans the save
+        WriteResult writeFile(const std::string& path, const TM::EditBatch &batch, bool dryRun = false);
+
+        std::vector<ReadResult> read(std::span<const std::string> paths, const std::unordered_set<int> *props = nullptr);
+        std::vector<WriteResult> write(std::span<const WriteRequest> requests, bool dryRun = false);
+
+        // read results in one of the read mode output formats, unreadable files are left out
+        void writeResults(std::ostream &out, std::span<const ReadResult> results, OW::outputFormat format, const std::vector<int> &columns) const;
+
+        // null without an index path
+        TI::TagIndex *index() const;
+        bool saveIndex();
+
+    private:
+        WP::WorkPool &workers();
+
+        SessionOptions options;
+        std::unique_ptr<TI::TagIndex> tagIndex;
+        // only started by the first batch call
+        std::unique_ptr<WP::WorkPool> pool;
+        // held for a whole batch call, also guards starting the pool
+        std::mutex batchMutex;
+    };
+}
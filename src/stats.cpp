@@ -0,0 +1,148 @@
+#include "stats.h"
+
+#include <bit>
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+namespace {
+    constexpr std::array<const char *, ST::COUNTER_COUNT> counterNames = {
+        "files_scanned", "files_unsupported", "files_parsed", "bytes_read", "bytes_written", "saves", "files_unchanged", "saves_in_place", "saves_rewritten", "saves_taglib", "files_prefetched"
+    };
+
+    constexpr std::array<const char *, ST::PHASE_COUNT> phaseNames = {
+        "walk", "sniff", "parse", "save", "image_io", "output"
+    };
+
+    // latencies go into power of two buckets (by nanoseconds), enough to tell a 50us parse from a 5ms one
+    constexpr int bucketCount = 64;
+
+    struct Phase {
+        std::atomic<std::uint64_t> samples = 0;
+        std::atomic<std::uint64_t> totalNs = 0;
+        std::atomic<std::uint64_t> maxNs = 0;
+        std::array<std::atomic<std::uint64_t>, bucketCount> buckets {};
+    };
+
+    std::array<std::atomic<std::uint64_t>, ST::COUNTER_COUNT> counters {};
+    std::array<Phase, ST::PHASE_COUNT> phases;
+
+    struct IoCounters {
+        std::uint64_t read = 0;
+        std::uint64_t written = 0;
+    };
+
+    std::chrono::steady_clock::time_point startTime;
+    IoCounters startIo;
+
+    // bytes passed through read/write syscalls of the whole process, including TagLib (Linux only, zero elsewhere)
+    IoCounters processIo() {
+        IoCounters result;
+        std::ifstream io ("/proc/self/io");
+        std::string key;
+        std::uint64_t value;
+        while (io >> key >> value) {
+            if (key == "rchar:") result.read = value;
+            if (key == "wchar:") result.written = value;
+        }
+        return result;
+    }
+
+    // upper bound of the bucket the given share of samples falls into, in microseconds
+    double percentileUs(const Phase &phase, double p) {
+        std::uint64_t samples = phase.samples;
+        if (samples == 0) return 0;
+
+        auto target = static_cast<std::uint64_t>(samples * p);
+        std::uint64_t seen = 0;
+        for (int i = 0; i < bucketCount; i++) {
+            seen += phase.buckets[i];
+            if (seen > target) return std::min<double>(std::uint64_t {1} << i, phase.maxNs) / 1e3;
+        }
+        return phase.maxNs / 1e3;
+    }
+}
+
+std::atomic<bool> ST::detail::active = false;
+
+void ST::detail::add(counterTypes counter, std::uint64_t amount) {
+    counters[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void ST::detail::record(phaseTypes phase, std::chrono::steady_clock::duration elapsed) {
+    auto ns = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    Phase &target = phases[phase];
+
+    target.samples.fetch_add(1, std::memory_order_relaxed);
+    target.totalNs.fetch_add(ns, std::memory_order_relaxed);
+    target.buckets[std::min(static_cast<int>(std::bit_width(ns)), bucketCount - 1)].fetch_add(1, std::memory_order_relaxed);
+
+    std::uint64_t max = target.maxNs.load(std::memory_order_relaxed);
+    while (ns > max && !target.maxNs.compare_exchange_weak(max, ns, std::memory_order_relaxed)) {}
+}
+
+void ST::enable() {
+    if constexpr (compiledIn) {
+        startTime = std::chrono::steady_clock::now();
+        startIo = processIo();
+        detail::active = true;
+    }
+}
+
+void ST::printSummary(std::ostream &out, bool json) {
+    if constexpr (!compiledIn) {
+        out << "Stats are not available, epictagmanager was built without EPICTAG_STATS" << std::endl;
+        return;
+    }
+
+    double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+    IoCounters io = processIo();
+    io = {io.read - startIo.read, io.written - startIo.written};
+
+    if (json) {
+        out << std::fixed << std::setprecision(3);
+        out << "{\"wall_ms\":" << wallMs << ",\"counters\":{";
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            if (i > 0) out << ',';
+            out << '"' << counterNames[i] << "\":" << counters[i].load();
+        }
+        out << "},\"process_io\":{\"read_bytes\":" << io.read << ",\"written_bytes\":" << io.written << "},\"phases\":{";
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            if (i > 0) out << ',';
+            const Phase &phase = phases[i];
+            out << '"' << phaseNames[i] << "\":{"
+                << "\"count\":" << phase.samples.load()
+                << ",\"total_ms\":" << phase.totalNs / 1e6
+                << ",\"p50_us\":" << percentileUs(phase, 0.5)
+                << ",\"p99_us\":" << percentileUs(phase, 0.99)
+                << ",\"max_us\":" << phase.maxNs / 1e3 << '}';
+        }
+        out << "}}" << std::endl;
+        return;
+    }
+
+    out << "Stats after " << std::fixed << std::setprecision(1) << wallMs << " ms" << std::endl;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        out << "  " << std::left << std::setw(22) << counterNames[i] << std::right << std::setw(14) << counters[i].load() << std::endl;
+    }
+    out << "  " << std::left << std::setw(22) << "process_read_bytes" << std::right << std::setw(14) << io.read << std::endl;
+    out << "  " << std::left << std::setw(22) << "process_written_bytes" << std::right << std::setw(14) << io.written << std::endl;
+
+    // the phase times add up over all threads, with -j above 1 they can exceed the wall time
+    out << "  " << std::left << std::setw(10) << "phase"
+        << std::right << std::setw(10) << "count"
+        << std::setw(12) << "total ms"
+        << std::setw(10) << "p50 us"
+        << std::setw(10) << "p99 us"
+        << std::setw(12) << "max us" << std::endl;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        const Phase &phase = phases[i];
+        if (phase.samples == 0) continue;
+        out << "  " << std::left << std::setw(10) << phaseNames[i]
+            << std::right << std::setw(10) << phase.samples.load()
+            << std::setprecision(1) << std::setw(12) << phase.totalNs / 1e6
+            << std::setw(10) << percentileUs(phase, 0.5)
+            << std::setw(10) << percentileUs(phase, 0.99)
+            << std::setw(12) << phase.maxNs / 1e3 << std::endl;
+    }
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+
+// 0 compiles every counter and timer below down to nothing, set through the EPICTAG_STATS CMake option
+// (the generated epictag_config.h, so it always matches the library)
+#if __has_include("epictag_config.h")
+#include "epictag_config.h"
+#endif
+#ifndef EPICTAG_STATS
+#define EPICTAG_STATS 1
+#endif
+
+namespace ST {
+    inline constexpr bool compiledIn = EPICTAG_STATS;
+
+    enum counterTypes : int {
+        FILES_SCANNED,     // input files checked by FH::isSupportedAudio
+        FILES_UNSUPPORTED, // input files rejected by the header check or by TagLib
+        FILES_PARSED,      // files opened through TagLib or the fast tag reader
+        BYTES_READ,        // bytes read by epictagmanager itself, TagLib's own reads are in the process I/O
+        BYTES_WRITTEN,     // bytes written by epictagmanager itself (exported pictures)
+        SAVES,             // TagLib saves
+        FILES_UNCHANGED,   // writes skipped because the file already had the requested tags
+        SAVES_IN_PLACE,    // saves that fit into the existing tag area
+        SAVES_REWRITTEN,   // saves that had to move the audio, done through a copy
+        SAVES_TAGLIB,      // saves left to TagLib, because the tag area isn't predicted or a copy can't replace the file
+        FILES_PREFETCHED,  // files whose tag regions were handed to the kernel ahead of parsing (--prefetch)
+        COUNTER_COUNT
+    };
+
+    enum phaseTypes : int {
+        WALK,     // reading one input directory
+        SNIFF,    // header check of one input file
+        PARSE,    // opening one file and parsing its tags
+        SAVE,     // one TagLib save
+        IMAGE_IO, // reading or writing one picture file
+        OUTPUT,   // writing finished output to the console
+        PHASE_COUNT
+    };
+
+    namespace detail {
+        // only set while --stats is used, so a normal run doesn't even read the clock
+        extern std::atomic<bool> active;
+
+        void add(counterTypes counter, std::uint64_t amount);
+        void record(phaseTypes phase, std::chrono::steady_clock::duration elapsed);
+    }
+
+    // start collecting, also remembers the start time and process I/O for the summary
+    void enable();
+
+    inline bool enabled() {
+        if constexpr (compiledIn) {
+            return detail::active.load(std::memory_order_relaxed);
+        } else {
+            return false;
+        }
+    }
+
+    inline void count(counterTypes counter, std::uint64_t amount = 1) {
+        if constexpr (compiledIn) {
+            if (enabled()) detail::add(counter, amount);
+        }
+    }
+
+    // times the scope it lives in (or until stop), every timer is one sample of the phase's latency histogram
+    class Timer {
+    public:
+        explicit Timer(phaseTypes phase) : phase(phase) {
+            if constexpr (compiledIn) {
+                if (enabled()) {
+                    running = true;
+                    start = std::chrono::steady_clock::now();
+                }
+            }
+        }
+
+        ~Timer() {
+            stop();
+        }
+
+        Timer(const Timer &) = delete;
+        Timer &operator=(const Timer &) = delete;
+
+        void stop() {
+            if constexpr (compiledIn) {
+                if (running) {
+                    running = false;
+                    detail::record(phase, std::chrono::steady_clock::now() - start);
+                }
+            }
+        }
+
+    private:
+        phaseTypes phase;
+        bool running = false;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    // print everything collected so far, either readable or as a single JSON object
+    void printSummary(std::ostream &out, bool json);
+}
@@ -0,0 +1,219 @@
+#include "sync.h"
+
+#include <charconv>
+#include <filesystem>
+#include <fileref.h>
+#include <fstream>
+#include <string_view>
+#include <vector>
+
+#include "file_handler.h"
+#include "output_writer.h"
+#include "stats.h"
+#include "tag_manager.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    std::string normalize(const std::string &path) {
+        std::error_code ec;
+        fs::path absolute = fs::absolute(path, ec);
+        return (ec ? fs::path(path) : absolute).lexically_normal().string();
+    }
+
+    std::vector<std::string_view> splitTabs(std::string_view line) {
+        std::vector<std::string_view> fields;
+        while (true) {
+            auto end = line.find('\t');
+            fields.push_back(line.substr(0, end));
+            if (end == std::string_view::npos) break;
+            line.remove_prefix(end + 1);
+        }
+        return fields;
+    }
+
+    template <typename T>
+    bool parseNumber(std::string_view value, T &result) {
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), result);
+        return ec == std::errc() && end == value.data() + value.size();
+    }
+}
+
+const std::string &SY::itemLabel(const Pair &pair) {
+    return pair.source;
+}
+
+std::string SY::pairKey(const std::string &path, const std::string &root) {
+    fs::path relative = fs::path(normalize(path)).lexically_relative(normalize(root));
+    return relative.replace_extension().generic_string();
+}
+
+SY::PairSource::PairSource(const std::string &sourceDir, const std::string &targetDir, const DW::WalkOptions &walkOptions)
+    : sourceRoot(sourceDir) {
+    DW::DirWalker targetWalker ({targetDir}, walkOptions);
+    std::string target;
+    while (targetWalker.next(target)) {
+        auto [it, inserted] = targets.emplace(pairKey(target, targetDir), target);
+        if (!inserted) {
+            std::cerr << "WARN: " << target << " has the same name as " << it->second << " and will not be synced" << std::endl;
+        }
+    }
+
+    sourceWalker = std::make_unique<DW::DirWalker>(std::vector<std::string> {sourceDir}, walkOptions);
+}
+
+bool SY::PairSource::next(Pair &pair) {
+    while (sourceWalker->next(pair.source)) {
+        auto it = targets.find(pairKey(pair.source, sourceRoot));
+        if (it == targets.end()) {
+            unpaired++;
+            continue;
+        }
+
+        auto [paired, inserted] = pairedTargets.emplace(it->second, pair.source);
+        if (!inserted) {
+            std::cerr << "WARN: " << pair.source << " has the same name as " << paired->second << " and will not be synced" << std::endl;
+            continue;
+        }
+        pair.target = it->second;
+        return true;
+    }
+    return false;
+}
+
+std::size_t SY::PairSource::unpairedCount() const {
+    return unpaired;
+}
+
+SY::SyncState::SyncState(std::string statePath) : statePath(std::move(statePath)) {
+    std::ifstream in (this->statePath, std::ios_base::in | std::ios_base::binary);
+    std::string line;
+    while (std::getline(in, line)) {
+        auto fields = splitTabs(line);
+        if (fields.size() != 6) continue;
+
+        Entry entry;
+        entry.source = OW::unescapeTsv(fields[1]);
+        if (!parseNumber(fields[2], entry.sourceStamp.size) || !parseNumber(fields[3], entry.sourceStamp.mtimeNs)
+            || !parseNumber(fields[4], entry.targetStamp.size) || !parseNumber(fields[5], entry.targetStamp.mtimeNs)) {
+            continue;
+        }
+        entries.insert_or_assign(OW::unescapeTsv(fields[0]), std::move(entry));
+    }
+}
+
+bool SY::SyncState::upToDate(const Pair &pair, const TI::FileStamp &source, const TI::FileStamp &target) const {
+    std::lock_guard lock(mutex);
+    auto it = entries.find(pair.target);
+    return it != entries.end()
+        && it->second.source == pair.source
+        && it->second.sourceStamp == source
+        && it->second.targetStamp == target;
+}
+
+void SY::SyncState::update(const Pair &pair, const TI::FileStamp &source, const TI::FileStamp &target) {
+    std::lock_guard lock(mutex);
+    entries.insert_or_assign(pair.target, Entry {pair.source, source, target});
+    changed = true;
+}
+
+bool SY::SyncState::save() {
+    std::lock_guard lock(mutex);
+    if (!changed) return true;
+
+    // same as the tag index, a temp file renamed over the old state
+    std::string tmpPath = FH::makeTempFile(statePath);
+    if (tmpPath.empty()) {
+        std::cerr << "Could not create a temporary file for sync state " << statePath << std::endl;
+        return false;
+    }
+    std::ofstream out (tmpPath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    for (auto &[target, entry] : entries) {
+        out << OW::escapeTsv(target) << '\t' << OW::escapeTsv(entry.source)
+            << '\t' << entry.sourceStamp.size << '\t' << entry.sourceStamp.mtimeNs
+            << '\t' << entry.targetStamp.size << '\t' << entry.targetStamp.mtimeNs << '\n';
+    }
+    out.close();
+    std::error_code ec;
+    if (!out) {
+        std::cerr << "Could not write sync state " << tmpPath << std::endl;
+        fs::remove(tmpPath, ec);
+        return false;
+    }
+
+    fs::rename(tmpPath, statePath, ec);
+    if (ec) {
+        std::cerr << "Could not replace sync state " << statePath << ": " << ec.message() << std::endl;
+        fs::remove(tmpPath, ec);
+        return false;
+    }
+    changed = false;
+    return true;
+}
+
+SY::syncResults SY::syncPair(const Pair &pair, SyncState &state, const SyncOptions &options, std::ostream &out) {
+    // nightly runs only open the pairs where something changed
+    TI::FileStamp sourceStamp, targetStamp;
+    if (!TI::statFile(pair.source, sourceStamp) || !TI::statFile(pair.target, targetStamp)) return SYNC_FAILED;
+    if (state.upToDate(pair, sourceStamp, targetStamp)) return SYNC_SKIPPED;
+    // the walk only checked the extensions
+    if (!FH::isSupportedAudio(pair.source) || !FH::isSupportedAudio(pair.target)) {
+        std::cerr << "WARN: Unsupported file in pair " << pair.source << " -> " << pair.target << std::endl;
+        return SYNC_FAILED;
+    }
+
+    ST::Timer parseTimer (ST::PARSE);
+    // the source is only read, its audio properties are never needed
+    TagLib::FileRef source (pair.source.data(), false);
+    TagLib::FileRef target (pair.target.data());
+    parseTimer.stop();
+    if (source.isNull() || target.isNull()) {
+        ST::count(ST::FILES_UNSUPPORTED);
+        std::cerr << "WARN: Unsupported file in pair " << pair.source << " -> " << pair.target << std::endl;
+        return SYNC_FAILED;
+    }
+    ST::count(ST::FILES_PARSED, 2);
+
+    // every synced tag of the source replaces the one of the target, the ones the source doesn't have are removed
+    TM::EditBatch batch;
+    batch.padding = options.padding;
+    if (options.props.empty()) {
+        batch.propLists = TM::readAllProps(source);
+        for (auto &[type, values] : TM::readAllProps(target)) {
+            batch.propLists.try_emplace(type);
+        }
+    } else {
+        batch.propLists = TM::readProps(source, options.props);
+    }
+
+    // pictures are compared by their data, the same cover in both files is no change
+    if (options.pictures) {
+        batch.replacePictures = true;
+        batch.pictureData = TM::getImgTags(source);
+    }
+
+    TM::EditDiff diff = TM::diffEdits(target, batch);
+    if (options.dryRun) {
+        if (!diff.empty() || options.verbose) {
+            out << "Changes to " << pair.target << " from " << pair.source << ":" << std::endl;
+            TM::printDiff(diff, out);
+            out << std::endl;
+        }
+        return diff.empty() ? SYNC_UNCHANGED : SYNC_WRITTEN;
+    }
+
+    TM::commitResults result = TM::commitEdits(target, batch, diff);
+    if (!result) {
+        std::cerr << "Could not save changes to " << pair.target << std::endl;
+        return SYNC_FAILED;
+    }
+    if (result != TM::COMMIT_UNCHANGED) {
+        out << "Synced " << pair.target << ": " << TM::commitResultName(result) << std::endl;
+    } else if (options.verbose) {
+        out << "Already up to date: " << pair.target << std::endl;
+    }
+
+    // the target was just saved, the new stamp is the one the next run compares against
+    if (TI::statFile(pair.target, targetStamp)) state.update(pair, sourceStamp, targetStamp);
+    return result == TM::COMMIT_UNCHANGED ? SYNC_UNCHANGED : SYNC_WRITTEN;
+}
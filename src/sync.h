@@ -0,0 +1,100 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "dir_walker.h"
+#include "tag_index.h"
+
+namespace SY {
+    // a source file and the target file its tags are copied to
+    struct Pair {
+        std::string source;
+        std::string target;
+    };
+
+    // name of a pair in error messages (see WP::forEachOrdered)
+    const std::string &itemLabel(const Pair &pair);
+
+    // path relative to root without its extension, so "Artist/Album/01.flac" pairs with "Artist/Album/01.mp3"
+    std::string pairKey(const std::string &path, const std::string &root);
+
+    // pairs the files of a source directory with the files of a target directory by pairKey
+    // the target directory is walked completely up front, source files are paired while the source is still being walked
+    // names that are taken twice (01.flac and 01.mp3) only pair the first file found, the others are warned about
+    class PairSource {
+    public:
+        PairSource(const std::string& sourceDir, const std::string& targetDir, const DW::WalkOptions &walkOptions);
+
+        // the next source file that has a target, false once the source was walked completely
+        bool next(Pair &pair);
+
+        // source files without a target so far
+        std::size_t unpairedCount() const;
+
+    private:
+        std::string sourceRoot;
+        std::unordered_map<std::string, std::string> targets;
+        // targets handed out already, another source for one of them would race the first on the same file
+        std::unordered_map<std::string, std::string> pairedTargets;
+        std::unique_ptr<DW::DirWalker> sourceWalker;
+        std::size_t unpaired = 0;
+    };
+
+    // the stamps of both files of each pair right after its last sync
+    // pairs where neither file changed since are skipped without opening them
+    //
+    // file layout: one line per pair, TSV-escaped
+    //   target | source | source size | source mtime ns | target size | target mtime ns
+    // safe to use from multiple threads
+    class SyncState {
+    public:
+        // a missing file just starts out empty
+        explicit SyncState(std::string statePath);
+
+        bool upToDate(const Pair &pair, const TI::FileStamp &source, const TI::FileStamp &target) const;
+        void update(const Pair &pair, const TI::FileStamp &source, const TI::FileStamp &target);
+
+        // write the state back if anything changed, the old file is replaced atomically
+        bool save();
+
+    private:
+        struct Entry {
+            std::string source;
+            TI::FileStamp sourceStamp;
+            TI::FileStamp targetStamp;
+        };
+
+        std::string statePath;
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, Entry> entries;
+        bool changed = false;
+    };
+
+    enum syncResults : int {
+        SYNC_FAILED = 0,
+        SYNC_SKIPPED,   // neither file changed since the last sync, nothing was opened
+        SYNC_UNCHANGED, // both were compared, the target already had the tags of the source
+        SYNC_WRITTEN,   // the target was saved (or would be, in a dry run)
+    };
+
+    struct SyncOptions {
+        // propTypes to sync, every one if empty
+        std::unordered_set<int> props;
+        // also replace the pictures of the target if they differ from the source
+        bool pictures = true;
+        std::uint64_t padding = 4096;
+        // print the differences instead of saving them, the state is left alone
+        bool dryRun = false;
+        bool verbose = false;
+    };
+
+    // copy the tags of pair.source to pair.target with a single save, if they differ
+    // tags the target has but the source doesn't are removed
+    syncResults syncPair(const Pair &pair, SyncState &state, const SyncOptions &options, std::ostream &out);
+}
@@ -0,0 +1,281 @@
+#include "tag_index.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file_handler.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    constexpr std::string_view indexMagic = "ETAGIDX1";
+
+    template <typename T>
+    void appendRaw(std::string &out, T value) {
+        out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    // bounds-checked reader over one region of the mapping, any read past the end marks it as failed
+    struct Reader {
+        const char *data;
+        std::size_t size;
+        std::size_t pos = 0;
+        bool failed = false;
+
+        template <typename T>
+        T read() {
+            T value {};
+            if (failed || size - pos < sizeof(T)) {
+                failed = true;
+                return value;
+            }
+            std::memcpy(&value, data + pos, sizeof(T));
+            pos += sizeof(T);
+            return value;
+        }
+
+        std::string_view readBytes(std::size_t length) {
+            if (failed || size - pos < length) {
+                failed = true;
+                return {};
+            }
+            std::string_view result (data + pos, length);
+            pos += length;
+            return result;
+        }
+    };
+
+    std::string encodeEntry(const std::string &key, const TI::FileStamp &stamp, const std::map<int, TagLib::StringList> &props) {
+        std::string out;
+        appendRaw<std::uint32_t>(out, key.size());
+        out += key;
+        appendRaw<std::uint64_t>(out, stamp.size);
+        appendRaw<std::int64_t>(out, stamp.mtimeNs);
+        appendRaw<std::uint16_t>(out, props.size());
+
+        for (auto &[type, values] : props) {
+            appendRaw<std::uint16_t>(out, type);
+            appendRaw<std::uint16_t>(out, values.size());
+            for (auto &value : values) {
+                std::string utf8 = value.to8Bit(true);
+                appendRaw<std::uint32_t>(out, utf8.size());
+                out += utf8;
+            }
+        }
+        return out;
+    }
+
+    // reads the header of an entry (path and stamp), leaving the reader at the start of the properties
+    std::string_view decodeEntryHeader(Reader &reader, TI::FileStamp &stamp) {
+        auto pathLength = reader.read<std::uint32_t>();
+        std::string_view path = reader.readBytes(pathLength);
+        stamp.size = reader.read<std::uint64_t>();
+        stamp.mtimeNs = reader.read<std::int64_t>();
+        return path;
+    }
+
+    // skips over (or decodes, if props isn't null) the properties of an entry
+    void decodeEntryProps(Reader &reader, std::map<int, TagLib::StringList> *props) {
+        auto propCount = reader.read<std::uint16_t>();
+        for (std::uint16_t i = 0; i < propCount && !reader.failed; i++) {
+            auto type = reader.read<std::uint16_t>();
+            auto valueCount = reader.read<std::uint16_t>();
+
+            TagLib::StringList values;
+            for (std::uint16_t v = 0; v < valueCount && !reader.failed; v++) {
+                auto length = reader.read<std::uint32_t>();
+                std::string_view value = reader.readBytes(length);
+                if (props) values.append(TagLib::String(std::string(value), TagLib::String::UTF8));
+            }
+
+            if (props) props->insert({type, values});
+        }
+    }
+
+    std::optional<std::map<int, TagLib::StringList>> decodeIfCurrent(const char *data, std::size_t size, const TI::FileStamp &stamp) {
+        Reader reader {data, size};
+        TI::FileStamp stored;
+        decodeEntryHeader(reader, stored);
+        if (reader.failed || stored != stamp) return std::nullopt;
+
+        std::map<int, TagLib::StringList> props;
+        decodeEntryProps(reader, &props);
+        if (reader.failed) return std::nullopt;
+        return props;
+    }
+}
+
+bool TI::statFile(const std::string &path, FileStamp &stamp) {
+    struct stat st {};
+    if (::stat(path.c_str(), &st) != 0) return false;
+
+    stamp.size = st.st_size;
+    stamp.mtimeNs = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+TI::TagIndex::TagIndex(std::string indexPath) : indexPath(std::move(indexPath)) {
+    loadMapping();
+}
+
+TI::TagIndex::~TagIndex() {
+    unmap();
+}
+
+std::string TI::TagIndex::normalizeKey(const std::string &path) const {
+    // the same file can be passed as a relative path from different working directories
+    std::error_code ec;
+    fs::path absolute = fs::absolute(path, ec);
+    if (ec) return path;
+    return absolute.lexically_normal().string();
+}
+
+void TI::TagIndex::loadMapping() {
+    int fd = ::open(indexPath.c_str(), O_RDONLY);
+    if (fd < 0) return; // no index yet
+
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(indexMagic.size() + sizeof(std::uint32_t))) {
+        ::close(fd);
+        return;
+    }
+
+    void *data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        std::cerr << "WARN: Could not map tag index " << indexPath << ", starting with an empty index" << std::endl;
+        return;
+    }
+
+    mapData = static_cast<const char *>(data);
+    mapSize = st.st_size;
+
+    Reader reader {mapData, mapSize};
+    if (reader.readBytes(indexMagic.size()) != indexMagic) {
+        std::cerr << "WARN: " << indexPath << " is not a tag index, it will be overwritten" << std::endl;
+        unmap();
+        return;
+    }
+
+    // only the paths are looked at here, the properties get decoded on lookup
+    auto entryCount = reader.read<std::uint32_t>();
+    for (std::uint32_t i = 0; i < entryCount && !reader.failed; i++) {
+        std::size_t start = reader.pos;
+        FileStamp stamp;
+        std::string_view path = decodeEntryHeader(reader, stamp);
+        decodeEntryProps(reader, nullptr);
+
+        if (!reader.failed) mapped[path] = {start, reader.pos - start};
+    }
+
+    if (reader.failed) {
+        std::cerr << "WARN: Tag index " << indexPath << " is truncated, only " << mapped.size() << " entries were kept" << std::endl;
+    }
+}
+
+void TI::TagIndex::unmap() {
+    mapped.clear();
+    if (mapData) {
+        ::munmap(const_cast<char *>(mapData), mapSize);
+        mapData = nullptr;
+        mapSize = 0;
+    }
+}
+
+std::optional<std::map<int, TagLib::StringList>> TI::TagIndex::lookup(const std::string &path, const FileStamp &stamp) {
+    std::string key = normalizeKey(path);
+    std::lock_guard lock(mutex);
+
+    std::optional<std::map<int, TagLib::StringList>> result;
+    if (auto it = updated.find(key); it != updated.end()) {
+        result = decodeIfCurrent(it->second.data(), it->second.size(), stamp);
+    } else if (auto mappedIt = mapped.find(key); mappedIt != mapped.end()) {
+        result = decodeIfCurrent(mapData + mappedIt->second.offset, mappedIt->second.length, stamp);
+    }
+
+    if (result) {
+        hitCount++;
+    } else {
+        missCount++;
+    }
+    return result;
+}
+
+void TI::TagIndex::update(const std::string &path, const FileStamp &stamp, const std::map<int, TagLib::StringList> &props) {
+    std::string key = normalizeKey(path);
+    std::string entry = encodeEntry(key, stamp, props);
+
+    std::lock_guard lock(mutex);
+    updated[key] = std::move(entry);
+}
+
+bool TI::TagIndex::save() {
+    std::lock_guard lock(mutex);
+    if (updated.empty()) return true;
+
+    // write everything into a temp file next to the index and rename it over the old one,
+    // so an interrupted save can't leave a half-written index behind
+    std::string tmpPath = FH::makeTempFile(indexPath);
+    std::ofstream out;
+    if (!tmpPath.empty()) out.open(tmpPath, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+    if (!out.is_open()) {
+        std::cerr << "Could not create a temporary file for tag index " << indexPath << std::endl;
+        std::error_code ec;
+        if (!tmpPath.empty()) fs::remove(tmpPath, ec);
+        return false;
+    }
+
+    std::uint32_t entryCount = updated.size();
+    for (auto &[path, entry] : mapped) {
+        if (!updated.contains(std::string(path))) entryCount++;
+    }
+
+    std::string header (indexMagic);
+    appendRaw<std::uint32_t>(header, entryCount);
+    out.write(header.data(), header.size());
+
+    // unchanged entries are copied over as they are, without decoding them
+    for (auto &[path, entry] : mapped) {
+        if (updated.contains(std::string(path))) continue;
+        out.write(mapData + entry.offset, entry.length);
+    }
+    for (auto &[path, entry] : updated) {
+        out.write(entry.data(), entry.size());
+    }
+
+    out.close();
+    std::error_code ec;
+    if (!out) {
+        std::cerr << "Could not write tag index " << tmpPath << std::endl;
+        fs::remove(tmpPath, ec);
+        return false;
+    }
+
+    fs::rename(tmpPath, indexPath, ec);
+    if (ec) {
+        std::cerr << "Could not replace tag index " << indexPath << ": " << ec.message() << std::endl;
+        fs::remove(tmpPath, ec);
+        return false;
+    }
+
+    // continue from the freshly written file
+    updated.clear();
+    unmap();
+    loadMapping();
+    return true;
+}
+
+std::size_t TI::TagIndex::hits() const {
+    return hitCount;
+}
+
+std::size_t TI::TagIndex::misses() const {
+    return missCount;
+}
@@ -0,0 +1,78 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tstringlist.h>
+#include <unordered_map>
+
+namespace TI {
+    // what an index entry is validated against, if either changed the file has to be parsed again
+    struct FileStamp {
+        std::uint64_t size = 0;
+        std::int64_t mtimeNs = 0;
+
+        bool operator==(const FileStamp &) const = default;
+    };
+
+    // get the current size and modification time of a file, false if it can't be stat-ed
+    bool statFile(const std::string& path, FileStamp &stamp);
+
+    // persistent cache of all defined properties of each file, keyed by the absolute path
+    // the index file is memory-mapped on load and entries are only decoded when they're looked up,
+    // so unchanged files can be answered without opening them at all
+    //
+    // file layout (native byte order):
+    //   "ETAGIDX1" | u32 entry count | entries...
+    //   entry: u32 path length | path | u64 size | i64 mtime ns | u16 prop count | props...
+    //   prop:  u16 propType | u16 value count | (u32 length | UTF-8 value)...
+    //
+    // all methods are safe to call from multiple threads
+    class TagIndex {
+    public:
+        // a missing or unreadable index file just starts out as an empty index
+        explicit TagIndex(std::string indexPath);
+        ~TagIndex();
+
+        TagIndex(const TagIndex &) = delete;
+        TagIndex &operator=(const TagIndex &) = delete;
+
+        // all indexed properties of the file, if it's indexed and the stamp still matches
+        std::optional<std::map<int, TagLib::StringList>> lookup(const std::string& path, const FileStamp &stamp);
+
+        // store (or replace) the properties of the file, props should contain every defined property
+        void update(const std::string& path, const FileStamp &stamp, const std::map<int, TagLib::StringList> &props);
+
+        // write the index back to disk if anything changed, the old file is replaced atomically
+        bool save();
+
+        std::size_t hits() const;
+        std::size_t misses() const;
+
+    private:
+        struct MappedEntry {
+            std::size_t offset; // start of the entry in the mapping
+            std::size_t length;
+        };
+
+        std::string normalizeKey(const std::string& path) const;
+        void loadMapping();
+        void unmap();
+
+        std::string indexPath;
+
+        const char *mapData = nullptr;
+        std::size_t mapSize = 0;
+        // keys point into the mapping, so loading doesn't copy any paths
+        std::unordered_map<std::string_view, MappedEntry> mapped;
+        // new or changed entries, already encoded, these win over mapped ones
+        std::unordered_map<std::string, std::string> updated;
+
+        std::mutex mutex;
+        std::size_t hitCount = 0;
+        std::size_t missCount = 0;
+    };
+}
@@ -0,0 +1,386 @@
+#include "tag_layout.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <flacfile.h>
+#include <id3v2tag.h>
+#include <iostream>
+#include <mpegfile.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+#include <vector>
+
+#include "stats.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    // TagLib's own minimum padding it adds whenever a tag outgrows its area
+    constexpr std::uint64_t flacMinPadding = 4096;
+    constexpr std::uint64_t id3v2MinPadding = 1024;
+    // slack for the FLAC size prediction, TagLib and this file count the block headers slightly differently
+    constexpr std::uint64_t flacSlack = 16;
+    // the largest FLAC metadata block (24 bit length)
+    constexpr std::uint64_t maxFlacBlock = 0xFFFFFF;
+
+    bool readAt(int fd, std::uint64_t offset, char *data, std::size_t size) {
+        while (size > 0) {
+            ssize_t n = ::pread(fd, data, size, static_cast<off_t>(offset));
+            if (n <= 0) return false;
+            data += n;
+            offset += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    bool writeAll(int fd, const char *data, std::size_t size) {
+        ST::count(ST::BYTES_WRITTEN, size);
+        while (size > 0) {
+            ssize_t n = ::write(fd, data, size);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    bool writeAll(int fd, const std::string &data) {
+        return writeAll(fd, data.data(), data.size());
+    }
+
+    // copy everything of in from offset to the end
+    bool copyRest(int in, int out, std::uint64_t offset) {
+        std::vector<char> buffer (1 << 20);
+        while (true) {
+            ssize_t n = ::pread(in, buffer.data(), buffer.size(), static_cast<off_t>(offset));
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) return false;
+            if (n == 0) return true;
+            ST::count(ST::BYTES_READ, n);
+            if (!writeAll(out, buffer.data(), n)) return false;
+            offset += n;
+        }
+    }
+
+    // copy the owner, group, mode and extended attributes of in to out
+    bool copyMetadata(int in, int out) {
+        struct stat st {};
+        if (::fstat(in, &st) != 0) return false;
+        if (::fchown(out, st.st_uid, st.st_gid) != 0 || ::fchmod(out, st.st_mode & 07777) != 0) return false;
+
+        ssize_t listSize = ::flistxattr(in, nullptr, 0);
+        if (listSize < 0) return errno == ENOTSUP;
+        std::vector<char> names (listSize);
+        listSize = ::flistxattr(in, names.data(), names.size());
+        if (listSize < 0) return false;
+
+        for (const char *name = names.data(); name < names.data() + listSize; name += std::strlen(name) + 1) {
+            ssize_t valueSize = ::fgetxattr(in, name, nullptr, 0);
+            std::vector<char> value (std::max<ssize_t>(valueSize, 0));
+            if (valueSize < 0 || ::fgetxattr(in, name, value.data(), value.size()) != valueSize) return false;
+            if (::fsetxattr(out, name, value.data(), value.size(), 0) != 0) {
+                // security labels are given to new files by the system already and mostly can't be set by users
+                if (std::strncmp(name, "security.", 9) != 0) return false;
+            }
+        }
+        return true;
+    }
+
+    std::uint32_t bigEndian(const unsigned char *data, int bytes) {
+        std::uint32_t result = 0;
+        for (int i = 0; i < bytes; i++) result = (result << 8) | data[i];
+        return result;
+    }
+
+    void appendBigEndian(std::string &out, std::uint64_t value, int bytes) {
+        for (int i = bytes - 1; i >= 0; i--) out += static_cast<char>((value >> (i * 8)) & 0xFF);
+    }
+
+    void appendSyncsafe(std::string &out, std::uint64_t value) {
+        for (int i = 3; i >= 0; i--) out += static_cast<char>((value >> (i * 7)) & 0x7F);
+    }
+
+    // size of all FLAC metadata blocks TagLib is going to write for the changes staged in flac, without padding
+    std::optional<std::uint64_t> flacDataSize(TagLib::FLAC::File *flac, const TL::TagArea &area) {
+        auto *xiph = flac->xiphComment();
+        if (!xiph) return std::nullopt;
+
+        std::uint64_t result = area.kept + 4 + xiph->render(false).size();
+        for (auto *picture : flac->pictureList()) {
+            result += 4 + picture->render().size();
+        }
+        return result;
+    }
+
+    // frames of the staged ID3v2 tag, without header and padding
+    // a tag that doesn't fit its area is rendered with TagLib's minimum padding, which is taken off again
+    std::uint64_t id3v2FrameSize(TagLib::MPEG::File *mpeg) {
+        auto *tag = mpeg->ID3v2Tag();
+        if (!tag || tag->isEmpty()) return 0;
+
+        std::uint64_t rendered = tag->render(TagLib::ID3v2::v4).size();
+        return rendered > 10 + id3v2MinPadding ? rendered - 10 - id3v2MinPadding : 0;
+    }
+
+    // "fLaC", the kept metadata blocks, then a single PADDING block big enough for the new tags plus the reserve
+    bool writeFlacArea(int in, int out, const TL::TagArea &area, std::uint64_t dataSize, std::uint64_t reserve) {
+        std::string marker (area.start, '\0');
+        if (!readAt(in, 0, marker.data(), marker.size()) || !writeAll(out, marker)) return false;
+
+        std::string blocks (area.size, '\0');
+        if (!readAt(in, area.start, blocks.data(), blocks.size())) return false;
+
+        std::string kept;
+        std::size_t pos = 0;
+        while (pos + 4 <= blocks.size()) {
+            auto *header = reinterpret_cast<const unsigned char *>(blocks.data() + pos);
+            int type = header[0] & 0x7F;
+            std::uint32_t length = bigEndian(header + 1, 3);
+            if (pos + 4 + length > blocks.size()) return false;
+
+            if (type != 1) {
+                // the last block flag moves to the padding block below
+                kept += static_cast<char>(type);
+                kept.append(blocks, pos + 1, 3 + length);
+            }
+            pos += 4 + length;
+        }
+
+        // TagLib replaces the comment and picture blocks in there with the new ones, the rest of the padding stays
+        std::uint64_t paddingLength = std::min(
+            (dataSize > kept.size() ? dataSize - kept.size() : 0) + reserve + flacSlack,
+            maxFlacBlock
+        );
+        kept += static_cast<char>(0x80 | 1);
+        appendBigEndian(kept, paddingLength, 3);
+        kept.append(paddingLength, '\0');
+        return writeAll(out, kept);
+    }
+
+    // the old ID3v2 tag with its size raised, so the new frames plus the reserve fit behind the old ones
+    bool writeId3v2Area(int in, int out, const TL::TagArea &area, std::uint64_t frameSize, std::uint64_t reserve) {
+        std::string tag;
+        std::uint64_t oldBody = 0;
+        if (area.size >= 10) {
+            tag.resize(area.size);
+            if (!readAt(in, 0, tag.data(), tag.size())) return false;
+            oldBody = area.size - 10;
+            tag.resize(6);
+        } else {
+            // no tag yet, start with an empty ID3v2.4 one
+            tag = "ID3\x04";
+            tag += '\0';
+            tag += '\0';
+        }
+
+        std::uint64_t body = std::max(oldBody, frameSize + reserve);
+        appendSyncsafe(tag, body);
+        if (!writeAll(out, tag)) return false;
+
+        if (oldBody > 0) {
+            std::string frames (oldBody, '\0');
+            if (!readAt(in, 10, frames.data(), frames.size()) || !writeAll(out, frames)) return false;
+        }
+        return writeAll(out, std::string(body - oldBody, '\0'));
+    }
+}
+
+TL::TagArea TL::readTagArea(const std::string &path) {
+    TagArea area;
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return area;
+
+    struct stat st {};
+    if (::fstat(fd, &st) == 0) area.fileSize = st.st_size;
+
+    unsigned char header[10];
+    if (!readAt(fd, 0, reinterpret_cast<char *>(header), sizeof(header))) {
+        ::close(fd);
+        return area;
+    }
+
+    if (std::equal(header, header + 4, "fLaC")) {
+        area.type = FLAC;
+        area.start = 4;
+
+        // walk the block headers up to the last one, like FR does when reading
+        std::uint64_t offset = area.start;
+        unsigned char block[4];
+        while (readAt(fd, offset, reinterpret_cast<char *>(block), sizeof(block))) {
+            bool last = block[0] & 0x80;
+            int type = block[0] & 0x7F;
+            std::uint32_t length = bigEndian(block + 1, 3);
+
+            if (type == 1) {
+                area.padding += length;
+            } else if (type != 4 && type != 6) {
+                area.kept += 4 + length;
+            }
+            offset += 4 + length;
+
+            if (last) {
+                area.size = offset - area.start;
+                ::close(fd);
+                return area;
+            }
+        }
+        // ran into the end of the file, leave it to TagLib
+        area.type = OTHER;
+    } else if (std::equal(header, header + 3, "ID3")) {
+        area.type = ID3V2;
+        std::uint64_t size = 0;
+        for (int i = 6; i < 10; i++) size = (size << 7) | (header[i] & 0x7F);
+        area.footer = header[5] & 0x10;
+        area.size = 10 + size + (area.footer ? 10 : 0);
+    } else if (header[0] == 0xFF && (header[1] & 0xE0) == 0xE0) {
+        // MPEG audio without any ID3v2 tag yet
+        area.type = ID3V2;
+    }
+
+    ::close(fd);
+    return area;
+}
+
+bool TL::fitsInPlace(const TagLib::FileRef &f, const TagArea &area) {
+    if (area.type == FLAC) {
+        auto *flac = dynamic_cast<TagLib::FLAC::File *>(f.file());
+        if (!flac) return false;
+
+        auto dataSize = flacDataSize(flac, area);
+        if (!dataSize || *dataSize + 4 + flacSlack > area.size) return false;
+
+        // leftover padding above TagLib's limit gets cut down, which moves the audio as well
+        std::uint64_t padding = area.size - *dataSize - 4;
+        return padding + flacSlack <= maxPadding(area.fileSize, flacMinPadding);
+    }
+
+    if (area.type == ID3V2 && !area.footer) {
+        auto *mpeg = dynamic_cast<TagLib::MPEG::File *>(f.file());
+        if (!mpeg) return false;
+
+        // an empty tag gets stripped completely
+        auto *tag = mpeg->ID3v2Tag();
+        if (!tag || tag->isEmpty()) return area.size == 0;
+
+        // TagLib renders the tag with the padding it's going to write, so this is exact
+        return tag->render(TagLib::ID3v2::v4).size() == area.size;
+    }
+
+    return false;
+}
+
+bool TL::canReplace(const std::string &path) {
+    struct stat st {};
+    if (::lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode) || st.st_nlink > 1) return false;
+    if (::geteuid() == 0) return true;
+
+    // anyone else can only create files of their own, in one of their groups
+    if (st.st_uid != ::geteuid()) return false;
+    if (st.st_gid == ::getegid()) return true;
+    int count = ::getgroups(0, nullptr);
+    std::vector<gid_t> groups (std::max(count, 0));
+    count = ::getgroups(groups.size(), groups.data());
+    return count > 0 && std::find(groups.begin(), groups.begin() + count, st.st_gid) != groups.begin() + count;
+}
+
+std::optional<std::string> TL::copyWithPadding(const TagLib::FileRef &f, const std::string &path, const TagArea &area, std::uint64_t padding) {
+    fs::path source (path);
+    std::string extension = source.extension().string();
+    // hidden file next to the original, so the rename stays on the same filesystem
+    std::string tmp = (source.parent_path() / ("." + source.filename().string() + ".epictag-XXXXXX" + extension)).string();
+
+    int out = ::mkstemps(tmp.data(), static_cast<int>(extension.size()));
+    if (out < 0) {
+        std::cerr << "Could not create a temporary file next to " << path << std::endl;
+        return std::nullopt;
+    }
+
+    int in = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    bool success = in >= 0;
+
+    if (success && !copyMetadata(in, out)) {
+        ::close(in);
+        ::close(out);
+        ::unlink(tmp.c_str());
+        return std::nullopt;
+    }
+
+    std::uint64_t audioStart = 0;
+    if (success && area.type == FLAC) {
+        auto *flac = dynamic_cast<TagLib::FLAC::File *>(f.file());
+        auto dataSize = flac ? flacDataSize(flac, area) : std::nullopt;
+        if (dataSize) {
+            std::uint64_t reserve = std::clamp<std::uint64_t>(padding, flacSlack, maxPadding(area.fileSize, flacMinPadding) - 2 * flacSlack);
+            success = writeFlacArea(in, out, area, *dataSize, reserve);
+            audioStart = area.start + area.size;
+        }
+    } else if (success && area.type == ID3V2 && !area.footer) {
+        if (auto *mpeg = dynamic_cast<TagLib::MPEG::File *>(f.file())) {
+            std::uint64_t reserve = std::clamp<std::uint64_t>(padding, 1, maxPadding(area.fileSize, id3v2MinPadding));
+            success = writeId3v2Area(in, out, area, id3v2FrameSize(mpeg), reserve);
+            audioStart = area.size;
+        }
+    }
+
+    // if the staged tags can't be measured, the file is copied as it is and TagLib rewrites the copy
+    success = success && copyRest(in, out, audioStart);
+
+    if (in >= 0) ::close(in);
+    ::close(out);
+
+    if (!success) {
+        std::cerr << "Could not copy " << path << " for rewriting it" << std::endl;
+        ::unlink(tmp.c_str());
+        return std::nullopt;
+    }
+    return tmp;
+}
+
+bool TL::replaceFile(const std::string &tmp, const std::string &target) {
+    int fd = ::open(tmp.c_str(), O_RDONLY | O_CLOEXEC);
+    bool synced = fd >= 0 && ::fsync(fd) == 0;
+    if (fd >= 0) ::close(fd);
+
+    if (!synced || ::rename(tmp.c_str(), target.c_str()) != 0) {
+        std::cerr << "Could not replace " << target << " with its rewritten copy" << std::endl;
+        ::unlink(tmp.c_str());
+        return false;
+    }
+
+    // the rename itself only lasts once the directory is on disk too
+    std::string dir = fs::path(target).parent_path().string();
+    int dirFd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        ::fsync(dirFd);
+        ::close(dirFd);
+    }
+    return true;
+}
+
+std::uint64_t TL::maxPadding(std::uint64_t fileSize, std::uint64_t minPadding) {
+    return std::clamp<std::uint64_t>(fileSize / 100, minPadding, 1024 * 1024);
+}
+
+std::optional<std::uint64_t> TL::parseSize(const std::string &text) {
+    if (text.empty()) return std::nullopt;
+
+    char *end = nullptr;
+    errno = 0;
+    std::uint64_t value = std::strtoull(text.c_str(), &end, 10);
+    if (errno != 0 || end == text.c_str()) return std::nullopt;
+
+    std::string unit = end;
+    if (unit.empty()) return value;
+    if (unit == "K" || unit == "k") return value * 1024;
+    if (unit == "M" || unit == "m") return value * 1024 * 1024;
+    if (unit == "G" || unit == "g") return value * 1024 * 1024 * 1024;
+    return std::nullopt;
+}
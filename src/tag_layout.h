@@ -0,0 +1,57 @@
+#pragma once
+#include <cstdint>
+#include <fileref.h>
+#include <optional>
+#include <string>
+
+namespace TL {
+    enum layoutTypes {
+        OTHER, // tags somewhere TagLib handles on its own, a save can't be predicted
+        FLAC,  // metadata blocks after the "fLaC" marker
+        ID3V2  // ID3v2 tag in front of MPEG audio (or none yet)
+    };
+
+    // the tag area in front of the audio, TagLib rewrites it in place as long as the new tags fit into it
+    // anything that doesn't fit makes TagLib move the whole audio stream
+    struct TagArea {
+        layoutTypes type = OTHER;
+        // FLAC: offset of the first metadata block, ID3v2: 0
+        std::uint64_t start = 0;
+        // bytes from start up to the audio, including all padding
+        std::uint64_t size = 0;
+        std::uint64_t padding = 0;
+        // FLAC: bytes of the blocks TagLib keeps as they are (everything but comments, pictures and padding)
+        std::uint64_t kept = 0;
+        std::uint64_t fileSize = 0;
+        // ID3v2: the tag has a footer, TagLib never writes one, so it can't stay in place
+        bool footer = false;
+    };
+
+    // read the layout of the tag area of path, only the block/tag headers are read
+    TagArea readTagArea(const std::string& path);
+
+    // whether saving the changes staged in f fits into the current tag area
+    // false whenever it can't be told for sure, a wrong "false" only costs a copy, a wrong "true" a full rewrite
+    bool fitsInPlace(const TagLib::FileRef &f, const TagArea &area);
+
+    // whether a copy renamed over path loses nothing but the inode: a regular file without other hardlinks
+    // whose owner and group can be given to the copy
+    bool canReplace(const std::string& path);
+
+    // copy path next to itself, growing the tag area so the changes staged in f fit with padding bytes to spare
+    // the copy keeps the extension (TagLib picks the format by it), the permissions, owner, group and extended attributes
+    // (ACLs included) of path
+    // returns the path of the copy, nullopt if it couldn't be made or any of that couldn't be kept
+    std::optional<std::string> copyWithPadding(const TagLib::FileRef &f, const std::string& path, const TagArea &area, std::uint64_t padding);
+
+    // flush tmp to disk and rename it over target, after a crash target is either completely old or completely new
+    // tmp is removed if that fails
+    bool replaceFile(const std::string& tmp, const std::string& target);
+
+    // TagLib throws away padding above 1% of the file size (at most 1 MiB, at least minPadding) when saving,
+    // so this is the most padding that survives a save
+    std::uint64_t maxPadding(std::uint64_t fileSize, std::uint64_t minPadding);
+
+    // parse a size like 4096, 64K or 1M (K/M/G are powers of 1024)
+    std::optional<std::uint64_t> parseSize(const std::string& text);
+}
@@ -1,48 +1,76 @@
 #include "tag_manager.h"
 
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
 #include <fileref.h>
 #include <iostream>
 #include <tpropertymap.h>
-#include <unordered_map>
 #include <unordered_set>
 
 #include "file_handler.h"
+#include "image_store.h"
+#include "stats.h"
+#include "tag_layout.h"
 
-std::unordered_map<int, std::string> TM::propKeys = {
-    {ALBUM, "ALBUM"},
-    {ARTIST, "ARTIST"},
-    {BPM, "BPM"},
-    {COMMENT, "COMMENT"},
-    {COMPOSER, "COMPOSER"},
-    {YEAR, "DATE"},
-    {DISCNUMBER, "DISCNUMBER"},
-    {GENRE, "GENRE"},
-    {TITLE, "TITLE"},
-    {TRACKNUMBER, "TRACKNUMBER"},
-    {LANGUAGE, "LANGUAGE"},
-    {LYRICIST, "LYRICIST"},
-    {LYRICS, "LYRICS"},
-    {REMIXER, "REMIXER"},
-};
+namespace {
+    // TagLib::String has no constructor taking a string_view
+    TagLib::String keyOf(int type) {
+        return TagLib::String(std::string(TM::propKeys.at(type)));
+    }
+}
 
-std::map<int, TagLib::StringList> TM::readProps(const TagLib::FileRef& f, const std::unordered_set<int>& props) {
-    // outputs a map of propTypes and their respective values in the passed file f
+std::map<int, TagLib::StringList> TM::readProps(const TagLib::PropertyMap &propMap, const std::unordered_set<int>& props) {
+    // outputs a map of propTypes and their respective values in the passed property map
     std::map<int, TagLib::StringList> result;
-    TagLib::PropertyMap propMap = f.properties();
 
     for (auto& type : props) {
         // propKeys[type] corresponds to the relevant TagLib property key
-        TagLib::StringList propVal = propMap[propKeys[type]];
-        result.insert({type,propVal});
+        // find instead of operator[], which would insert an empty entry for every missing key
+        auto it = propMap.find(keyOf(type));
+        result.insert({type, it != propMap.end() ? it->second : TagLib::StringList()});
+    }
+
+    return result;
+}
+
+std::map<int, TagLib::StringList> TM::readProps(const TagLib::FileRef& f, const std::unordered_set<int>& props) {
+    return readProps(f.properties(), props);
+}
+
+std::map<int, TagLib::StringList> TM::readAllProps(const TagLib::PropertyMap &propMap) {
+    std::map<int, TagLib::StringList> result;
+
+    // same as readProps(propMap, findAllDefinedProps(propMap)), but in a single pass over the map
+    for (auto& [key, val]: propMap) {
+        if (val.isEmpty()) continue;
+
+        int type = findPropTypeByKey(key.to8Bit());
+        if (type != UNDEFINED) result.insert({type, val});
     }
 
     return result;
 }
 
-void TM::printProps(const std::map<int, TagLib::StringList> &propList) {
+std::map<int, TagLib::StringList> TM::readAllProps(const TagLib::FileRef &f) {
+    return readAllProps(f.properties());
+}
+
+std::map<int, TagLib::StringList> TM::selectProps(const std::map<int, TagLib::StringList> &propList, const std::unordered_set<int> &props) {
+    std::map<int, TagLib::StringList> result;
+
+    for (auto& type : props) {
+        auto it = propList.find(type);
+        result.insert({type, it != propList.end() ? it->second : TagLib::StringList()});
+    }
+
+    return result;
+}
+
+void TM::printProps(const std::map<int, TagLib::StringList> &propList, std::ostream &out) {
     // type is from propTypes, val is the actual tag value
     for (auto& [type, val] : propList) {
-        std::cout << "    " << propKeys[type] << ": " << val << std::endl;
+        out << "    " << propKeys.at(type) << ": " << val << std::endl;
     }
 }
 
@@ -53,114 +81,375 @@ void TM::writeProps(TagLib::FileRef& f, const std::map<int, std::string> &propLi
         // .replace explicitly requires a StringList even if only one val is used
         TagLib::StringList tag;
         tag.append(val);
-        propMap.replace(propKeys[type],tag);
+        propMap.replace(keyOf(type),tag);
     }
 
-    // writes the changes to the fileref
+    // stages the changes in the fileref, they're written to disk by the next save
     f.setProperties(propMap);
-    f.save();
 }
 
-int TM::findPropTypeByKey(const std::string& key) {
-    for (auto& [type, propKey]: propKeys) {
-        if (key == propKey) return type;
+void TM::writeProps(TagLib::FileRef& f, const std::map<int, TagLib::StringList> &propList) {
+    TagLib::PropertyMap propMap = f.properties();
+
+    for (auto& [type, vals] : propList) {
+        if (vals.isEmpty()) {
+            propMap.erase(keyOf(type));
+        } else {
+            propMap.replace(keyOf(type), vals);
+        }
     }
-    // if no suitable or defined key was found
-    return UNDEFINED;
+
+    f.setProperties(propMap);
 }
 
-std::unordered_set<int> TM::findAllDefinedProps(const TagLib::FileRef& f) {
+std::unordered_set<int> TM::findAllDefinedProps(const TagLib::PropertyMap &propMap) {
     std::unordered_set<int> result;
-    TagLib::PropertyMap propMap = f.properties();
 
-    // clean out any empty values so those don't get returned
-    propMap.removeEmpty();
-
-    // go through all file properties and pick out the ones that are defined in propTypes
+    // go through all file properties and pick out the non-empty ones that are defined in propTypes
     for (auto& [key, val]: propMap) {
-        int type = findPropTypeByKey(key.to8Bit()); // convert TagLib::String to std::string before passing as key
+        if (val.isEmpty()) continue;
+
+        int type = findPropTypeByKey(key.to8Bit()); // convert TagLib::String to std::string before looking up the key
         if (type != UNDEFINED) result.insert(type);
     }
 
     return result;
 }
 
-void TM::addImgTag(TagLib::FileRef &f, const std::string &imgPath) {
-    if (imgPath.empty()) {
-        return;
+std::unordered_set<int> TM::findAllDefinedProps(const TagLib::FileRef& f) {
+    return findAllDefinedProps(f.properties());
+}
+
+namespace {
+    // counts every save done through TM::saveFile
+    std::atomic<std::size_t> saves = 0;
+    // counts commits that didn't need a save
+    std::atomic<std::size_t> unchanged = 0;
+
+    // a list of nothing but empty strings is written the same as no value at all
+    bool isBlank(const TagLib::StringList &values) {
+        for (auto &value : values) {
+            if (!value.isEmpty()) return false;
+        }
+        return true;
     }
 
-    // I'm not treating it as an error because it technically still works with any file type
-    // which might be cool if you want to hide something in the image data tag
-    if (auto ext = FH::getExtOf(imgPath); ext != ".png" && ext != ".jpg" && ext != ".jpeg") {
-        std::cerr << "WARN: Provided image " << imgPath << " has an unusual extension: " << ext << std::endl;
+    bool sameValues(const TagLib::StringList &a, const TagLib::StringList &b) {
+        if (isBlank(a) || isBlank(b)) return isBlank(a) && isBlank(b);
+        return a == b;
     }
 
-    // static so they don't reset in every function call
-    static auto lastImgPath = imgPath;
-    static auto imgData = FH::getImgByteVector(imgPath);
+    std::string joinValues(const TagLib::StringList &values) {
+        std::string result;
+        for (auto &value : values) {
+            if (!result.empty()) result += "; ";
+            result += value.to8Bit(true);
+        }
+        return result;
+    }
+
+    // build the PICTURE complex property for the image at imgPath
+    TagLib::VariantMap makeImgProp(const std::string &imgPath) {
+        // I'm not treating it as an error because it technically still works with any file type
+        // which might be cool if you want to hide something in the image data tag
+        if (auto ext = FH::getExtOf(imgPath); ext != ".png" && ext != ".jpg" && ext != ".jpeg") {
+            std::cerr << "WARN: Provided image " << imgPath << " has an unusual extension: " << ext << std::endl;
+        }
+
+        // every image is read only once, all files it's embedded into share the same buffer
+        auto image = IS::get(imgPath);
 
-    // optimization for multiple files in a row having the same img being set (e.g. in an album)
-    if (imgPath != lastImgPath) {
-        imgData = FH::getImgByteVector(imgPath);
+        // Make the property list for the provided image
+        return {
+            {"data", image->data},
+            {"pictureType", "Front Cover"},
+            {"mimeType", image->mimeType}
+        };
     }
 
-    TagLib::String mimeType;
-    // png file magic number
-    if (imgData.startsWith("\x89PNG\x0d\x0a\x1a\x0a")) {
-        mimeType = "image/png";
-    } else {
-        mimeType = "image/jpeg";
+    TagLib::VariantMap makeImgProp(const TM::ImgTag &img) {
+        return {
+            {"data", img.data},
+            {"pictureType", img.pictureType},
+            {"mimeType", img.mimeType}
+        };
+    }
+}
+
+namespace {
+    // stage every change of the batch in f, without saving
+    void stageEdits(TagLib::FileRef &f, const TM::EditBatch &batch) {
+        if (!batch.props.empty()) {
+            TM::writeProps(f, batch.props);
+        }
+        if (!batch.propLists.empty()) {
+            TM::writeProps(f, batch.propLists);
+        }
+
+        if (batch.replacePictures) {
+            // build the whole new picture list at once instead of clearing and appending one by one
+            TagLib::List<TagLib::VariantMap> pictures;
+            for (auto& imgPath : batch.pictures) {
+                if (!imgPath.empty()) pictures.append(makeImgProp(imgPath));
+            }
+            for (auto& img : batch.pictureData) {
+                pictures.append(makeImgProp(img));
+            }
+            f.setComplexProperties("PICTURE", pictures);
+        } else {
+            for (auto& imgPath : batch.pictures) {
+                TM::addImgTag(f, imgPath);
+            }
+            if (!batch.pictureData.empty()) {
+                auto pictures = f.complexProperties("PICTURE");
+                for (auto& img : batch.pictureData) {
+                    pictures.append(makeImgProp(img));
+                }
+                f.setComplexProperties("PICTURE", pictures);
+            }
+        }
     }
+}
 
-    // Make the property list for the provided image
-    TagLib::VariantMap imgPropMap = {
-        {"data", imgData},
-        {"pictureType", "Front Cover"},
-        {"mimeType", mimeType}
-    };
+void TM::addImgTag(TagLib::FileRef &f, const std::string &imgPath) {
+    if (imgPath.empty()) {
+        return;
+    }
 
     // extract the current picture data, append the new data
     auto complexProps = f.complexProperties("PICTURE");
-    complexProps.append(imgPropMap);
+    complexProps.append(makeImgProp(imgPath));
     f.setComplexProperties("PICTURE",complexProps);
+}
 
-    f.save();
+bool TM::saveFile(TagLib::FileRef &f) {
+    ST::Timer timer (ST::SAVE);
+    ST::count(ST::SAVES);
+    saves++;
+    return f.save();
 }
 
-bool TM::extractImgTags(TagLib::FileRef &f) {
-    TagLib::ByteVector imgData;
-    TagLib::String mimeType = "image/jpeg";
-    std::string filename = f.file()->name().toString().to8Bit(); // file -> FileName -> TagLib string -> std string
-    int imgCount = 0;
+std::size_t TM::saveCount() {
+    return saves;
+}
+
+TM::EditDiff TM::diffEdits(const TagLib::FileRef &f, const EditBatch &batch) {
+    EditDiff diff;
+
+    // the values each type ends up with, in the same order commitEdits applies them
+    std::map<int, TagLib::StringList> requested;
+    for (auto& [type, val] : batch.props) {
+        requested[type] = TagLib::StringList(val);
+    }
+    for (auto& [type, vals] : batch.propLists) {
+        requested[type] = vals;
+    }
+
+    if (!requested.empty()) {
+        TagLib::PropertyMap propMap = f.properties();
+        for (auto& [type, after] : requested) {
+            auto it = propMap.find(keyOf(type));
+            TagLib::StringList before = it != propMap.end() ? it->second : TagLib::StringList();
+            if (!sameValues(before, after)) {
+                diff.props.push_back({type, before, after});
+            }
+        }
+    }
+
+    // the pictures are only looked at if the batch touches them
+    if (!batch.replacePictures && batch.pictures.empty() && batch.pictureData.empty()) return diff;
+
+    auto current = getImgTags(f);
+    diff.picturesBefore = current.size();
+
+    std::vector<std::string> paths;
+    for (auto& imgPath : batch.pictures) {
+        if (!imgPath.empty()) paths.push_back(imgPath);
+    }
+
+    std::size_t added = paths.size() + batch.pictureData.size();
+    if (!batch.replacePictures) {
+        // appending always adds something
+        diff.picturesAfter = current.size() + added;
+        diff.picturesChanged = added > 0;
+        return diff;
+    }
+
+    diff.picturesAfter = added;
+    diff.picturesChanged = current.size() != added;
+    for (std::size_t i = 0; i < added && !diff.picturesChanged; i++) {
+        // the image store already has every image that's used more than once, this mostly costs a lookup
+        diff.picturesChanged = i < paths.size()
+            ? IS::get(paths[i])->data != current[i].data
+            : batch.pictureData[i - paths.size()].data != current[i].data;
+    }
+    return diff;
+}
+
+void TM::printDiff(const EditDiff &diff, std::ostream &out) {
+    if (diff.empty()) {
+        out << "No changes" << std::endl;
+        return;
+    }
+
+    for (auto& change : diff.props) {
+        out << propKeys[change.type] << ": ";
+        if (isBlank(change.before)) {
+            out << "(not set)";
+        } else {
+            out << '"' << joinValues(change.before) << '"';
+        }
+        out << " -> ";
+        if (isBlank(change.after)) {
+            out << "(removed)";
+        } else {
+            out << '"' << joinValues(change.after) << '"';
+        }
+        out << std::endl;
+    }
+
+    if (diff.picturesChanged) {
+        out << "PICTURE: " << diff.picturesBefore << " -> " << diff.picturesAfter << " pictures" << std::endl;
+    }
+}
+
+TM::commitResults TM::commitEdits(TagLib::FileRef &f, const EditBatch &batch) {
+    return commitEdits(f, batch, diffEdits(f, batch));
+}
+
+TM::commitResults TM::commitEdits(TagLib::FileRef &f, const EditBatch &batch, const EditDiff &diff) {
+    // re-running the same job shouldn't rewrite every file again
+    if (diff.empty()) {
+        unchanged++;
+        ST::count(ST::FILES_UNCHANGED);
+        return COMMIT_UNCHANGED;
+    }
+
+    stageEdits(f, batch);
+
+    // the copy has to replace the file a symlink points to, not the symlink
+    std::string path = static_cast<const char *>(f.file()->name());
+    std::error_code ec;
+    auto realPath = std::filesystem::canonical(path, ec);
+    if (!ec) path = realPath.string();
+
+    TL::TagArea area = TL::readTagArea(path);
+    if (TL::fitsInPlace(f, area)) {
+        ST::count(ST::SAVES_IN_PLACE);
+        // everything staged above goes to disk in this one save
+        return saveFile(f) ? COMMIT_IN_PLACE : COMMIT_FAILED;
+    }
+
+    // other formats often still fit (MP4 free atoms, Ogg page slack), TagLib knows best there
+    // and a file a copy can't replace without losing something is better shifted by TagLib as well
+    if (area.type == TL::OTHER || !TL::canReplace(path)) {
+        ST::count(ST::SAVES_TAGLIB);
+        return saveFile(f) ? COMMIT_SAVED : COMMIT_FAILED;
+    }
+
+    // TagLib would shift the whole audio stream inside the file, which a crash could leave half done
+    // instead the file is copied with enough padding, the copy gets the edits (in place) and replaces the file
+    auto tmp = TL::copyWithPadding(f, path, area, batch.padding);
+    if (!tmp) {
+        // the copy couldn't keep the file's metadata (or couldn't be made at all), save like TagLib always did
+        ST::count(ST::SAVES_TAGLIB);
+        return saveFile(f) ? COMMIT_SAVED : COMMIT_FAILED;
+    }
+    ST::count(ST::SAVES_REWRITTEN);
+
+    {
+        // closed before the rename, TagLib writes through a buffered stream that only has to reach the file on close
+        TagLib::FileRef copy (tmp->data());
+        if (copy.isNull()) {
+            std::remove(tmp->c_str());
+            return COMMIT_FAILED;
+        }
+        stageEdits(copy, batch);
+        if (!saveFile(copy)) {
+            std::remove(tmp->c_str());
+            return COMMIT_FAILED;
+        }
+    }
+
+    return TL::replaceFile(*tmp, path) ? COMMIT_REWRITTEN : COMMIT_FAILED;
+}
+
+TM::commitResults TM::planCommit(TagLib::FileRef &f, const EditBatch &batch, const EditDiff &diff) {
+    if (diff.empty()) return COMMIT_UNCHANGED;
+
+    stageEdits(f, batch);
+    std::string path = static_cast<const char *>(f.file()->name());
+    std::error_code ec;
+    auto realPath = std::filesystem::canonical(path, ec);
+    if (!ec) path = realPath.string();
+
+    TL::TagArea area = TL::readTagArea(path);
+    if (TL::fitsInPlace(f, area)) return COMMIT_IN_PLACE;
+    return area.type == TL::OTHER || !TL::canReplace(path) ? COMMIT_SAVED : COMMIT_REWRITTEN;
+}
+
+std::string_view TM::commitResultName(commitResults result) {
+    switch (result) {
+        case COMMIT_FAILED: return "failed";
+        case COMMIT_UNCHANGED: return "unchanged";
+        case COMMIT_IN_PLACE: return "in place";
+        case COMMIT_REWRITTEN: return "full rewrite";
+        case COMMIT_SAVED: return "saved by TagLib";
+    }
+    return "";
+}
+
+std::size_t TM::unchangedCount() {
+    return unchanged;
+}
+
+std::vector<TM::ImgTag> TM::getImgTags(const TagLib::FileRef &f) {
+    std::vector<ImgTag> result;
 
     // find all embedded pictures
     auto imgList = f.complexProperties("PICTURE");
     // go through all pictures
     for (auto& prop : imgList) {
+        ImgTag img;
         // individual properties of each picture
         for (auto& [key, val] : prop) {
             if (key == "data" && val.type() == TagLib::Variant::ByteVector) {
-                imgData = val.toByteVector();
+                img.data = val.toByteVector();
             } else if (key == "mimeType" && val.type() == TagLib::Variant::String) {
-                mimeType = val.toString();
+                img.mimeType = val.toString();
+            } else if (key == "pictureType" && val.type() == TagLib::Variant::String) {
+                img.pictureType = val.toString();
             }
         }
+        result.push_back(img);
+    }
 
+    return result;
+}
+
+std::string TM::imgExtensionOf(const TagLib::String &mimeType) {
+    if (mimeType == "image/png") return ".png";
+    return ".jpg";
+}
+
+std::string TM::imgExportName(const std::string &filename, int imgIdx, const TagLib::String &mimeType) {
+    // if one file has multiple images, enumerate them
+    std::string imgName = filename;
+    if (imgIdx > 0) imgName += "_" + std::to_string(imgIdx);
+    return imgName + imgExtensionOf(mimeType);
+}
+
+bool TM::extractImgTags(TagLib::FileRef &f) {
+    std::string filename = f.file()->name().toString().to8Bit(); // file -> FileName -> TagLib string -> std string
+    int imgCount = 0;
+
+    for (auto& img : getImgTags(f)) {
         // attempt to write the image data
         try {
-            // if one file has multiple images, enumerate them
-            std::string imgName = filename;
-            if (imgCount > 0) imgName += "_" + std::to_string(imgCount);
-
-            if (mimeType == "image/png") {
-                imgName += ".png";
-            } else {
-                imgName += ".jpg";
-            }
+            std::string imgName = imgExportName(filename, imgCount, img.mimeType);
 
             // if exporting failed, return a fail from this function too
-            if (FH::exportFile(imgData, imgName) == false) {
+            if (FH::exportFile(img.data, imgName) == false) {
                 std::cerr << "Could not extract picture data of " << imgName;
                 return false;
             }
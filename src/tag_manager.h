@@ -1,11 +1,19 @@
 #pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
 #include <fileref.h>
+#include <tpropertymap.h>
+#include <iostream>
+#include <map>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <unordered_set>
+#include <vector>
 
 namespace TM {
     // property types for code readability
+    // the values are stored in tag indexes, so new types are only ever appended before PROP_COUNT
     enum propTypes : int {
         UNDEFINED = -1,
         ALBUM = 1,
@@ -21,30 +29,383 @@ namespace TM {
         LANGUAGE,
         LYRICIST,
         LYRICS,
-        REMIXER
+        REMIXER,
+        ALBUMARTIST,
+        ALBUMARTISTSORT,
+        ALBUMSORT,
+        ARTISTSORT,
+        TITLESORT,
+        COMPOSERSORT,
+        SUBTITLE,
+        DISCSUBTITLE,
+        ORIGINALDATE,
+        RELEASEDATE,
+        ORIGINALALBUM,
+        ORIGINALARTIST,
+        ORIGINALLYRICIST,
+        ORIGINALFILENAME,
+        ARRANGER,
+        CONDUCTOR,
+        ENGINEER,
+        PRODUCER,
+        DJMIXER,
+        MIXER,
+        ARTISTS,
+        PERFORMER,
+        MUSICIANCREDITS,
+        WORK,
+        MOVEMENTNAME,
+        MOVEMENTNUMBER,
+        MOVEMENTCOUNT,
+        SHOWWORKMOVEMENT,
+        GROUPING,
+        COMPILATION,
+        ISRC,
+        ASIN,
+        BARCODE,
+        CATALOGNUMBER,
+        LABEL,
+        MEDIA,
+        MOOD,
+        INITIALKEY,
+        COPYRIGHT,
+        LICENSE,
+        OWNER,
+        ENCODEDBY,
+        ENCODING,
+        ENCODINGTIME,
+        TAGGINGDATE,
+        FILETYPE,
+        LENGTH,
+        PLAYLISTDELAY,
+        PRODUCEDNOTICE,
+        RADIOSTATION,
+        RADIOSTATIONOWNER,
+        RELEASECOUNTRY,
+        RELEASESTATUS,
+        RELEASETYPE,
+        SCRIPT,
+        TRACKTOTAL,
+        DISCTOTAL,
+        GAPLESSPLAYBACK,
+        PODCAST,
+        PODCASTCATEGORY,
+        PODCASTDESC,
+        PODCASTID,
+        PODCASTURL,
+        ARTISTWEBPAGE,
+        AUDIOSOURCEWEBPAGE,
+        COPYRIGHTURL,
+        FILEWEBPAGE,
+        PAYMENTWEBPAGE,
+        PUBLISHERWEBPAGE,
+        RADIOSTATIONWEBPAGE,
+        MUSICBRAINZ_ALBUMID,
+        MUSICBRAINZ_ALBUMARTISTID,
+        MUSICBRAINZ_ARTISTID,
+        MUSICBRAINZ_RELEASEGROUPID,
+        MUSICBRAINZ_RELEASETRACKID,
+        MUSICBRAINZ_TRACKID,
+        MUSICBRAINZ_WORKID,
+        ACOUSTID_ID,
+        ACOUSTID_FINGERPRINT,
+        MUSICIP_PUID,
+        REPLAYGAIN_TRACK_GAIN,
+        REPLAYGAIN_TRACK_PEAK,
+        REPLAYGAIN_ALBUM_GAIN,
+        REPLAYGAIN_ALBUM_PEAK,
+        // not a property, number of slots needed for an array indexed by propTypes
+        PROP_COUNT
     };
 
-    // maps propTypes to string keys to be used in audio PropertyMap maps
+    // maps propTypes to string keys to be used in audio PropertyMap maps, indexed by the propType itself
+    // covers the whole TagLib property mapping list
     // https://taglib.org/api/p_propertymapping.html
-    extern std::unordered_map<int, std::string> propKeys;
+    inline constexpr std::array<std::string_view, PROP_COUNT> propKeys = [] {
+        std::array<std::string_view, PROP_COUNT> keys {};
+        keys[ALBUM] = "ALBUM";
+        keys[ARTIST] = "ARTIST";
+        keys[BPM] = "BPM";
+        keys[COMMENT] = "COMMENT";
+        keys[COMPOSER] = "COMPOSER";
+        keys[YEAR] = "DATE";
+        keys[DISCNUMBER] = "DISCNUMBER";
+        keys[GENRE] = "GENRE";
+        keys[TITLE] = "TITLE";
+        keys[TRACKNUMBER] = "TRACKNUMBER";
+        keys[LANGUAGE] = "LANGUAGE";
+        keys[LYRICIST] = "LYRICIST";
+        keys[LYRICS] = "LYRICS";
+        keys[REMIXER] = "REMIXER";
+        keys[ALBUMARTIST] = "ALBUMARTIST";
+        keys[ALBUMARTISTSORT] = "ALBUMARTISTSORT";
+        keys[ALBUMSORT] = "ALBUMSORT";
+        keys[ARTISTSORT] = "ARTISTSORT";
+        keys[TITLESORT] = "TITLESORT";
+        keys[COMPOSERSORT] = "COMPOSERSORT";
+        keys[SUBTITLE] = "SUBTITLE";
+        keys[DISCSUBTITLE] = "DISCSUBTITLE";
+        keys[ORIGINALDATE] = "ORIGINALDATE";
+        keys[RELEASEDATE] = "RELEASEDATE";
+        keys[ORIGINALALBUM] = "ORIGINALALBUM";
+        keys[ORIGINALARTIST] = "ORIGINALARTIST";
+        keys[ORIGINALLYRICIST] = "ORIGINALLYRICIST";
+        keys[ORIGINALFILENAME] = "ORIGINALFILENAME";
+        keys[ARRANGER] = "ARRANGER";
+        keys[CONDUCTOR] = "CONDUCTOR";
+        keys[ENGINEER] = "ENGINEER";
+        keys[PRODUCER] = "PRODUCER";
+        keys[DJMIXER] = "DJMIXER";
+        keys[MIXER] = "MIXER";
+        keys[ARTISTS] = "ARTISTS";
+        keys[PERFORMER] = "PERFORMER";
+        keys[MUSICIANCREDITS] = "MUSICIANCREDITS";
+        keys[WORK] = "WORK";
+        keys[MOVEMENTNAME] = "MOVEMENTNAME";
+        keys[MOVEMENTNUMBER] = "MOVEMENTNUMBER";
+        keys[MOVEMENTCOUNT] = "MOVEMENTCOUNT";
+        keys[SHOWWORKMOVEMENT] = "SHOWWORKMOVEMENT";
+        keys[GROUPING] = "GROUPING";
+        keys[COMPILATION] = "COMPILATION";
+        keys[ISRC] = "ISRC";
+        keys[ASIN] = "ASIN";
+        keys[BARCODE] = "BARCODE";
+        keys[CATALOGNUMBER] = "CATALOGNUMBER";
+        keys[LABEL] = "LABEL";
+        keys[MEDIA] = "MEDIA";
+        keys[MOOD] = "MOOD";
+        keys[INITIALKEY] = "INITIALKEY";
+        keys[COPYRIGHT] = "COPYRIGHT";
+        keys[LICENSE] = "LICENSE";
+        keys[OWNER] = "OWNER";
+        keys[ENCODEDBY] = "ENCODEDBY";
+        keys[ENCODING] = "ENCODING";
+        keys[ENCODINGTIME] = "ENCODINGTIME";
+        keys[TAGGINGDATE] = "TAGGINGDATE";
+        keys[FILETYPE] = "FILETYPE";
+        keys[LENGTH] = "LENGTH";
+        keys[PLAYLISTDELAY] = "PLAYLISTDELAY";
+        keys[PRODUCEDNOTICE] = "PRODUCEDNOTICE";
+        keys[RADIOSTATION] = "RADIOSTATION";
+        keys[RADIOSTATIONOWNER] = "RADIOSTATIONOWNER";
+        keys[RELEASECOUNTRY] = "RELEASECOUNTRY";
+        keys[RELEASESTATUS] = "RELEASESTATUS";
+        keys[RELEASETYPE] = "RELEASETYPE";
+        keys[SCRIPT] = "SCRIPT";
+        keys[TRACKTOTAL] = "TRACKTOTAL";
+        keys[DISCTOTAL] = "DISCTOTAL";
+        keys[GAPLESSPLAYBACK] = "GAPLESSPLAYBACK";
+        keys[PODCAST] = "PODCAST";
+        keys[PODCASTCATEGORY] = "PODCASTCATEGORY";
+        keys[PODCASTDESC] = "PODCASTDESC";
+        keys[PODCASTID] = "PODCASTID";
+        keys[PODCASTURL] = "PODCASTURL";
+        keys[ARTISTWEBPAGE] = "ARTISTWEBPAGE";
+        keys[AUDIOSOURCEWEBPAGE] = "AUDIOSOURCEWEBPAGE";
+        keys[COPYRIGHTURL] = "COPYRIGHTURL";
+        keys[FILEWEBPAGE] = "FILEWEBPAGE";
+        keys[PAYMENTWEBPAGE] = "PAYMENTWEBPAGE";
+        keys[PUBLISHERWEBPAGE] = "PUBLISHERWEBPAGE";
+        keys[RADIOSTATIONWEBPAGE] = "RADIOSTATIONWEBPAGE";
+        keys[MUSICBRAINZ_ALBUMID] = "MUSICBRAINZ_ALBUMID";
+        keys[MUSICBRAINZ_ALBUMARTISTID] = "MUSICBRAINZ_ALBUMARTISTID";
+        keys[MUSICBRAINZ_ARTISTID] = "MUSICBRAINZ_ARTISTID";
+        keys[MUSICBRAINZ_RELEASEGROUPID] = "MUSICBRAINZ_RELEASEGROUPID";
+        keys[MUSICBRAINZ_RELEASETRACKID] = "MUSICBRAINZ_RELEASETRACKID";
+        keys[MUSICBRAINZ_TRACKID] = "MUSICBRAINZ_TRACKID";
+        keys[MUSICBRAINZ_WORKID] = "MUSICBRAINZ_WORKID";
+        keys[ACOUSTID_ID] = "ACOUSTID_ID";
+        keys[ACOUSTID_FINGERPRINT] = "ACOUSTID_FINGERPRINT";
+        keys[MUSICIP_PUID] = "MUSICIP_PUID";
+        keys[REPLAYGAIN_TRACK_GAIN] = "REPLAYGAIN_TRACK_GAIN";
+        keys[REPLAYGAIN_TRACK_PEAK] = "REPLAYGAIN_TRACK_PEAK";
+        keys[REPLAYGAIN_ALBUM_GAIN] = "REPLAYGAIN_ALBUM_GAIN";
+        keys[REPLAYGAIN_ALBUM_PEAK] = "REPLAYGAIN_ALBUM_PEAK";
+        return keys;
+    }();
+
+    namespace detail {
+        // FNV-1a mixed with a seed, the seed is picked at compile time so no two keys share a slot
+        constexpr std::uint32_t hashKey(std::string_view key, std::uint32_t seed) {
+            std::uint32_t hash = 2166136261u ^ seed;
+            for (char c : key) {
+                hash ^= static_cast<unsigned char>(c);
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+
+        // slot -> propType (0 for empty slots), big enough that a collision free seed is found after a few tries
+        constexpr std::size_t keyTableSize = 4096;
+
+        struct KeyTable {
+            std::uint32_t seed = 0;
+            std::array<std::uint8_t, keyTableSize> slots {};
+        };
+
+        // find a seed that gives every key its own slot, fails to compile if there is none
+        constexpr KeyTable buildKeyTable() {
+            for (std::uint32_t seed = 0; seed < 100000; seed++) {
+                KeyTable table;
+                table.seed = seed;
+
+                bool collision = false;
+                for (int type = 1; type < PROP_COUNT && !collision; type++) {
+                    auto &slot = table.slots[hashKey(propKeys[type], seed) % keyTableSize];
+                    if (slot != 0) {
+                        collision = true;
+                    } else {
+                        slot = type;
+                    }
+                }
+
+                if (!collision) return table;
+            }
+            throw "no collision free seed found for the property key table";
+        }
+
+        static_assert(PROP_COUNT <= 256, "propTypes have to fit into the uint8_t key table slots");
+        inline constexpr KeyTable keyTable = buildKeyTable();
+    }
+
+    // return the propType value of the provided key, UNDEFINED if it isn't a known key
+    // a single hash and compare thanks to the compile time perfect hash table
+    constexpr int findPropTypeByKey(std::string_view key) {
+        int type = detail::keyTable.slots[detail::hashKey(key, detail::keyTable.seed) % detail::keyTableSize];
+        if (type != 0 && propKeys[type] == key) return type;
+        // if no suitable or defined key was found
+        return UNDEFINED;
+    }
+
+    static_assert(findPropTypeByKey("DATE") == YEAR);
+    static_assert(findPropTypeByKey("REPLAYGAIN_ALBUM_PEAK") == REPLAYGAIN_ALBUM_PEAK);
+    static_assert(findPropTypeByKey("NOT A KEY") == UNDEFINED);
 
     // get all properties of given file based on set of propTypes type IDs
     std::map<int, TagLib::StringList> readProps(const TagLib::FileRef &f, const std::unordered_set<int> &props);
+    // same, from an already read PropertyMap (e.g. from FR::readTagProps)
+    std::map<int, TagLib::StringList> readProps(const TagLib::PropertyMap &propMap, const std::unordered_set<int> &props);
 
-    void printProps(const std::map<int, TagLib::StringList> &propList);
+    // get every non-empty property of the file that has a propType
+    std::map<int, TagLib::StringList> readAllProps(const TagLib::FileRef &f);
+    std::map<int, TagLib::StringList> readAllProps(const TagLib::PropertyMap &propMap);
+
+    // pick the requested propTypes out of an already read property list, missing ones are returned empty (same as readProps)
+    std::map<int, TagLib::StringList> selectProps(const std::map<int, TagLib::StringList> &propList, const std::unordered_set<int> &props);
+
+    // print the properties in a human readable way, one tag per line
+    void printProps(const std::map<int, TagLib::StringList> &propList, std::ostream &out = std::cout);
 
     // REPLACE properties of file based on given propList
+    // only stages the changes in f, they're written by the next save (see commitEdits)
     void writeProps(TagLib::FileRef &f, const std::map<int, std::string> &propList);
 
-    // search propKeys and return the propType value of the provided key
-    int findPropTypeByKey(const std::string& key);
+    // same as above for tags with any number of values, an empty list removes the tag
+    void writeProps(TagLib::FileRef &f, const std::map<int, TagLib::StringList> &propList);
 
     // find all non-empty properties in the given file
     std::unordered_set<int> findAllDefinedProps(const TagLib::FileRef &f);
+    std::unordered_set<int> findAllDefinedProps(const TagLib::PropertyMap &propMap);
 
     // adds a single PICTURE complex property (containing the file at imgPath) to the complex properties of f
+    // only stages the change, like writeProps
+    // safe to call from several threads at once as long as each thread works on its own FileRef
+    // images are loaded through the image store (IS::get), so each one is only read from disk once
     void addImgTag(TagLib::FileRef &f, const std::string& imgPath);
 
+    // data of one embedded picture
+    struct ImgTag {
+        TagLib::ByteVector data;
+        TagLib::String mimeType = "image/jpeg";
+        TagLib::String pictureType = "Front Cover";
+    };
+
+    // every change to be made to one file, so all of them can be written with a single save
+    struct EditBatch {
+        // text properties to replace
+        std::map<int, std::string> props;
+        // text properties with several (or no) values, applied after props
+        std::map<int, TagLib::StringList> propLists;
+        // drop all embedded pictures before adding the ones below
+        bool replacePictures = false;
+        // paths of images to embed
+        std::vector<std::string> pictures;
+        // pictures already in memory (e.g. taken from another file with getImgTags), embedded after the ones above
+        std::vector<ImgTag> pictureData;
+        // padding left in the tag area when the file has to be rewritten anyway, so later edits fit in place
+        std::uint64_t padding = 4096;
+    };
+
+    // what committing a batch would change in a file
+    struct EditDiff {
+        struct PropChange {
+            int type;
+            TagLib::StringList before;
+            TagLib::StringList after;
+        };
+
+        std::vector<PropChange> props;
+        bool picturesChanged = false;
+        // only filled in when the batch touches pictures
+        std::size_t picturesBefore = 0;
+        std::size_t picturesAfter = 0;
+
+        bool empty() const {
+            return props.empty() && !picturesChanged;
+        }
+    };
+
+    // compare the batch with the current state of f without staging anything
+    // pictures are compared by their data, so re-embedding the same cover is not a change
+    EditDiff diffEdits(const TagLib::FileRef &f, const EditBatch &batch);
+
+    // print the diff in a human readable way, one change per line
+    void printDiff(const EditDiff &diff, std::ostream &out = std::cout);
+
+    // how a commit went, COMMIT_FAILED is 0 so !commitEdits(...) still checks for failure
+    enum commitResults : int {
+        COMMIT_FAILED = 0,
+        COMMIT_UNCHANGED, // the file already matched, nothing was saved
+        COMMIT_IN_PLACE,  // the new tags fit into the existing tag area and padding
+        COMMIT_REWRITTEN, // the audio had to move, the file was rebuilt in a copy that replaced it
+        COMMIT_SAVED      // saved by TagLib on its own, for formats whose tag area isn't predicted (Ogg, MP4, ...)
+                          // and files a copy can't replace (see TL::canReplace), the audio may have moved in the file
+    };
+
+    // stage everything in the batch and write it to disk with exactly one save
+    // nothing is saved if the file already matches the batch (see diffEdits)
+    // FLAC and MPEG saves that would make TagLib move the audio are done on a copy with fresh padding, which is then
+    // renamed over the file (the real file if path is a symlink), so a crash never leaves a half written file behind
+    // the file gets a new inode then, but keeps its permissions, owner and extended attributes
+    commitResults commitEdits(TagLib::FileRef &f, const EditBatch &batch);
+
+    // same as above with a diff the caller already made for this batch, so it isn't compared twice
+    commitResults commitEdits(TagLib::FileRef &f, const EditBatch &batch, const EditDiff &diff);
+
+    // stage the batch in f and tell how committing it would go, without saving anything
+    commitResults planCommit(TagLib::FileRef &f, const EditBatch &batch, const EditDiff &diff);
+
+    // human readable name of a commit result
+    std::string_view commitResultName(commitResults result);
+
+    // number of commits skipped so far because the file already matched
+    std::size_t unchangedCount();
+
+    // save f, counting the saves so it can be checked how often files were rewritten
+    bool saveFile(TagLib::FileRef &f);
+
+    // number of saves done through saveFile so far
+    std::size_t saveCount();
+
+    // get all PICTURE properties of f, the data is shared with TagLib's copy and not duplicated
+    std::vector<ImgTag> getImgTags(const TagLib::FileRef &f);
+
+    // file extension (with the dot) used for exported pictures of the given MIME type
+    std::string imgExtensionOf(const TagLib::String &mimeType);
+
+    // name of the exported file for the imgIdx-th picture of filename, e.g. song.mp3_1.png
+    std::string imgExportName(const std::string& filename, int imgIdx, const TagLib::String &mimeType);
+
     // extracts PICTURE property data into a separate file
     bool extractImgTags(TagLib::FileRef &f);
 }
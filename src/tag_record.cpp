@@ -0,0 +1,171 @@
+#include "tag_record.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    // values bigger than this get a block of their own
+    constexpr std::size_t blockSize = 64 * 1024;
+
+    std::string joinValues(const TagLib::StringList &values) {
+        std::string joined;
+        for (auto it = values.begin(); it != values.end(); ++it) {
+            if (it != values.begin()) joined += '\0';
+            joined += it->to8Bit(true);
+        }
+        return joined;
+    }
+}
+
+std::string_view TR::ValuePool::store(std::string_view value) {
+    if (value.size() > blockSize) {
+        blocks.push_back(std::make_unique<char[]>(value.size()));
+        arenaBytes += value.size();
+        // the rest of the current block is given up, the next value starts a new one
+        blockUsed = blockSize;
+        std::copy(value.begin(), value.end(), blocks.back().get());
+        return {blocks.back().get(), value.size()};
+    }
+
+    if (blocks.empty() || blockUsed + value.size() > blockSize) {
+        blocks.push_back(std::make_unique<char[]>(blockSize));
+        blockUsed = 0;
+        arenaBytes += blockSize;
+    }
+    char *data = blocks.back().get() + blockUsed;
+    std::copy(value.begin(), value.end(), data);
+    blockUsed += value.size();
+    return {data, value.size()};
+}
+
+std::uint32_t TR::ValuePool::intern(const TagLib::StringList &values) {
+    return internJoined(joinValues(values));
+}
+
+std::uint32_t TR::ValuePool::internJoined(std::string_view joined) {
+    {
+        std::shared_lock lock(mutex);
+        auto it = byValue.find(joined);
+        if (it != byValue.end()) return it->second;
+    }
+
+    std::unique_lock lock(mutex);
+    // another thread might have stored it in between
+    auto it = byValue.find(joined);
+    if (it != byValue.end()) return it->second;
+
+    std::string_view stored = store(joined);
+    auto id = static_cast<std::uint32_t>(byId.size());
+    byId.push_back(stored);
+    byValue.emplace(stored, id);
+    return id;
+}
+
+std::string_view TR::ValuePool::lookup(std::uint32_t id) const {
+    std::shared_lock lock(mutex);
+    return byId.at(id);
+}
+
+std::size_t TR::ValuePool::count() const {
+    std::shared_lock lock(mutex);
+    return byId.size() - 1;
+}
+
+std::size_t TR::ValuePool::bytes() const {
+    std::shared_lock lock(mutex);
+    return arenaBytes;
+}
+
+TR::ValuePool &TR::defaultPool() {
+    // never destroyed, records in other static objects can still be read during shutdown
+    static ValuePool *pool = new ValuePool();
+    return *pool;
+}
+
+std::uint32_t TR::intern(const TagLib::StringList &values) {
+    return defaultPool().intern(values);
+}
+
+std::string_view TR::lookup(std::uint32_t id) {
+    return defaultPool().lookup(id);
+}
+
+std::size_t TR::internedCount() {
+    return defaultPool().count();
+}
+
+std::size_t TR::internedBytes() {
+    return defaultPool().bytes();
+}
+
+TR::TagRecord::TagRecord(const TagLib::PropertyMap &propMap, const std::unordered_set<int> *props, ValuePool &pool) : pool(&pool) {
+    // same matching as TM::readAllProps, without building the intermediate map
+    for (auto &[key, values] : propMap) {
+        if (values.isEmpty()) continue;
+
+        int type = TM::findPropTypeByKey(key.to8Bit());
+        if (type == TM::UNDEFINED || (props && !props->contains(type))) continue;
+        slots[type] = pool.intern(values);
+    }
+}
+
+TR::TagRecord::TagRecord(const std::map<int, TagLib::StringList> &propList, ValuePool &pool) : pool(&pool) {
+    for (auto &[type, values] : propList) {
+        if (type >= 0 && type < TM::PROP_COUNT) set(type, values);
+    }
+}
+
+TagLib::StringList TR::TagRecord::values(int type) const {
+    TagLib::StringList result;
+    if (!slots[type]) return result;
+
+    std::string_view joined = pool->lookup(slots[type]);
+    while (true) {
+        auto end = joined.find('\0');
+        result.append(TagLib::String(std::string(joined.substr(0, end)), TagLib::String::UTF8));
+        if (end == std::string_view::npos) break;
+        joined.remove_prefix(end + 1);
+    }
+    return result;
+}
+
+void TR::TagRecord::set(int type, const TagLib::StringList &values) {
+    slots[type] = values.isEmpty() ? 0 : pool->intern(values);
+}
+
+std::map<int, TagLib::StringList> TR::TagRecord::toProps() const {
+    std::map<int, TagLib::StringList> result;
+    for (int type = 0; type < TM::PROP_COUNT; type++) {
+        if (slots[type]) result.insert({type, values(type)});
+    }
+    return result;
+}
+
+std::map<int, TagLib::StringList> TR::TagRecord::toProps(const std::unordered_set<int> &props) const {
+    std::map<int, TagLib::StringList> result;
+    for (int type : props) result.insert({type, values(type)});
+    return result;
+}
+
+TagLib::PropertyMap TR::TagRecord::toPropertyMap() const {
+    TagLib::PropertyMap result;
+    for (int type = 0; type < TM::PROP_COUNT; type++) {
+        if (slots[type]) result.insert(TagLib::String(std::string(TM::propKeys[type])), values(type));
+    }
+    return result;
+}
+
+TR::TagRecord TR::TagRecord::moveTo(ValuePool &target) const {
+    TagRecord result;
+    result.pool = &target;
+    for (int type = 0; type < TM::PROP_COUNT; type++) {
+        // copied as they are, without splitting and joining the values again
+        if (slots[type]) result.slots[type] = target.internJoined(pool->lookup(slots[type]));
+    }
+    return result;
+}
@@ -0,0 +1,98 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <shared_mutex>
+#include <string_view>
+#include <tpropertymap.h>
+#include <tstringlist.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "tag_manager.h"
+
+namespace TR {
+    // every distinct value list stored in a TagRecord of this pool is kept exactly once
+    // the lists are stored UTF-8 with '\0' between the values, in large arena blocks that are never freed
+    // or moved while the pool exists, so ids and the views returned for them stay valid as long as the pool
+    // nothing is ever removed, a long running holder of records gets rid of values nobody uses anymore
+    // by moving its records into a fresh pool (see TagRecord::moveTo) and dropping the old one
+    // safe to use from multiple threads
+    class ValuePool {
+    public:
+        ValuePool() = default;
+
+        ValuePool(const ValuePool &) = delete;
+        ValuePool &operator=(const ValuePool &) = delete;
+
+        // id of the value list, stored first if it's new, never 0
+        std::uint32_t intern(const TagLib::StringList &values);
+        // the same for a list that's already '\0' separated, e.g. one looked up in another pool
+        std::uint32_t internJoined(std::string_view joined);
+        // the '\0' separated values of an id returned by intern
+        std::string_view lookup(std::uint32_t id) const;
+
+        // distinct value lists and the arena bytes they take up
+        std::size_t count() const;
+        std::size_t bytes() const;
+
+    private:
+        // copy value into the arena, mutex has to be held exclusively
+        std::string_view store(std::string_view value);
+
+        mutable std::shared_mutex mutex;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        std::size_t blockUsed = 0;
+        std::size_t arenaBytes = 0;
+        // index is the id, id 0 is never handed out and stands for "no value"
+        std::vector<std::string_view> byId {std::string_view()};
+        // keys point into the arena
+        std::unordered_map<std::string_view, std::uint32_t> byValue;
+    };
+
+    // the pool records use unless they're given another one, lives until the process exits
+    ValuePool &defaultPool();
+
+    // shortcuts for the default pool
+    std::uint32_t intern(const TagLib::StringList &values);
+    std::string_view lookup(std::uint32_t id);
+    std::size_t internedCount();
+    std::size_t internedBytes();
+
+    // the tags of one file as one interned id per propType, 0 for tags the file doesn't have
+    // a fixed size, so holding the tags of a whole library takes one allocation per file at most
+    // and repeated values like ARTIST, ALBUM or GENRE cost 4 bytes per file
+    // the ids belong to the pool the record was made with, which has to outlive it
+    class TagRecord {
+    public:
+        TagRecord() = default;
+        // only props is read out of the map, every defined tag if props is null
+        explicit TagRecord(const TagLib::PropertyMap &propMap, const std::unordered_set<int> *props = nullptr, ValuePool &pool = defaultPool());
+        explicit TagRecord(const std::map<int, TagLib::StringList> &propList, ValuePool &pool = defaultPool());
+
+        bool has(int type) const { return slots[type] != 0; }
+        TagLib::StringList values(int type) const;
+        // an empty list removes the tag
+        void set(int type, const TagLib::StringList &values);
+
+        // the same as TM::readAllProps/TM::selectProps would give for these tags
+        std::map<int, TagLib::StringList> toProps() const;
+        std::map<int, TagLib::StringList> toProps(const std::unordered_set<int> &props) const;
+
+        // the tags as TagLib property keys, for writes (e.g. merged into the PropertyMap of a file)
+        TagLib::PropertyMap toPropertyMap() const;
+
+        // the same tags with their ids in target
+        TagRecord moveTo(ValuePool &target) const;
+        const ValuePool *valuePool() const { return pool; }
+
+        bool operator==(const TagRecord &) const = default;
+
+    private:
+        std::array<std::uint32_t, TM::PROP_COUNT> slots {};
+        ValuePool *pool = &defaultPool();
+    };
+}
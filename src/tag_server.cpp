@@ -0,0 +1,636 @@
+#include "tag_server.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fileref.h>
+#include <iostream>
+#include <optional>
+#include <poll.h>
+#include <sstream>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <unordered_set>
+
+#include "fast_reader.h"
+#include "file_handler.h"
+#include "output_writer.h"
+#include "stats.h"
+#include "tag_manager.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    // the server SIGINT/SIGTERM are forwarded to
+    std::atomic<SV::TagServer *> signalTarget = nullptr;
+
+    void onSignal(int) {
+        if (auto *server = signalTarget.load()) server->stop();
+    }
+
+    constexpr std::uint32_t watchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_DELETE_SELF;
+    // a client that never sends a newline would otherwise make the server buffer whatever it sends
+    constexpr std::size_t maxLineSize = 4 * 1024 * 1024;
+
+    // same keys for the paths found on disk and the ones clients send
+    std::string normalize(const std::string &path) {
+        std::error_code ec;
+        fs::path absolute = fs::absolute(path, ec);
+        return (ec ? fs::path(path) : absolute).lexically_normal().string();
+    }
+
+    std::vector<std::string> splitFields(const std::string &line) {
+        std::vector<std::string> fields;
+        std::size_t start = 0;
+        while (true) {
+            std::size_t end = line.find('\t', start);
+            fields.push_back(OW::unescapeTsv(std::string_view(line).substr(start, end - start)));
+            if (end == std::string::npos) break;
+            start = end + 1;
+        }
+        return fields;
+    }
+
+    std::string errorLine(const std::string &message) {
+        return "{\"error\":\"" + OW::escapeJson(message) + "\"}\n";
+    }
+
+    bool sendAll(int fd, const std::string &data) {
+        std::size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = ::send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    std::string upper(std::string value) {
+        std::ranges::transform(value, value.begin(), [](unsigned char c) { return std::toupper(c); });
+        return value;
+    }
+}
+
+SV::TagServer::TagServer(ServeOptions options) : options(std::move(options)), pool(this->options.jobs) {
+    for (auto &input : this->options.paths) {
+        std::string path = FH::cleanPath(input);
+        if (path.empty()) continue;
+        std::string root = normalize(path);
+        if (FH::pathIsDir(path) && !root.ends_with('/')) root += '/';
+        roots.push_back(root);
+    }
+}
+
+SV::TagServer::~TagServer() {
+    stop();
+
+    {
+        std::lock_guard lock(clientMutex);
+        for (int fd : clientFds) ::shutdown(fd, SHUT_RDWR);
+    }
+    for (auto &thread : clientThreads) thread.join();
+    pool.wait();
+
+    if (listenFd >= 0) {
+        ::close(listenFd);
+        ::unlink(options.socketPath.c_str());
+    }
+    if (inotifyFd >= 0) ::close(inotifyFd);
+    for (int fd : wakeFds) {
+        if (fd >= 0) ::close(fd);
+    }
+
+    SV::TagServer *self = this;
+    signalTarget.compare_exchange_strong(self, nullptr);
+}
+
+void SV::TagServer::stop() {
+    stopping = true;
+    wake();
+}
+
+void SV::TagServer::wake() {
+    if (wakeFds[1] >= 0) {
+        char byte = 0;
+        // only fails if the pipe is full, which means the loop is being woken up already
+        [[maybe_unused]] auto written = ::write(wakeFds[1], &byte, 1);
+    }
+}
+
+bool SV::TagServer::run() {
+    if (::pipe2(wakeFds, O_CLOEXEC | O_NONBLOCK) != 0) return false;
+
+    inotifyFd = ::inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (inotifyFd < 0) {
+        std::cerr << "Could not set up inotify: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (!openSocket()) return false;
+
+    signalTarget = this;
+    std::signal(SIGINT, onSignal);
+    std::signal(SIGTERM, onSignal);
+
+    load();
+    if (options.verbose) {
+        std::cout << "Serving " << store.size() << " files on " << options.socketPath << std::endl;
+    }
+
+    pollfd fds[3] = {
+        {listenFd, POLLIN, 0},
+        {inotifyFd, POLLIN, 0},
+        {wakeFds[0], POLLIN, 0},
+    };
+
+    while (!stopping) {
+        if (::poll(fds, 3, -1) < 0) {
+            if (errno == EINTR) continue;
+            std::cerr << "Exception while serving: " << std::strerror(errno) << std::endl;
+            break;
+        }
+
+        if (fds[1].revents & POLLIN) handleEvents();
+
+        if (fds[2].revents & POLLIN) {
+            char drain[64];
+            while (::read(wakeFds[0], drain, sizeof(drain)) > 0) {}
+            reapClients();
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int client = ::accept4(listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client >= 0) {
+                // every client gets its own thread, requests of one client are answered in order
+                std::lock_guard lock(clientMutex);
+                clientFds.push_back(client);
+                clientThreads.emplace_back(&TagServer::serveClient, this, client);
+            }
+        }
+    }
+    return true;
+}
+
+bool SV::TagServer::openSocket() {
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    if (options.socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path is too long: " << options.socketPath << std::endl;
+        return false;
+    }
+    std::strcpy(address.sun_path, options.socketPath.c_str());
+
+    // a socket left behind by a server that didn't shut down cleanly
+    struct stat st {};
+    if (::stat(options.socketPath.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        ::unlink(options.socketPath.c_str());
+    }
+
+    listenFd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenFd < 0
+        || ::bind(listenFd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0
+        || ::listen(listenFd, 64) != 0) {
+        std::cerr << "Could not listen on " << options.socketPath << ": " << std::strerror(errno) << std::endl;
+        if (listenFd >= 0) ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+    return true;
+}
+
+void SV::TagServer::load() {
+    // watches go up before the walk, so nothing that changes in between is missed
+    std::vector<std::string> unused;
+    for (auto &input : options.paths) {
+        std::string path = FH::cleanPath(input);
+        if (!path.empty() && FH::pathIsDir(path)) watchTree(path, unused);
+    }
+
+    DW::DirWalker walker (options.paths, options.walkOptions);
+    const std::size_t maxInFlight = pool.size() * 64;
+    std::string file;
+    while (walker.next(file)) {
+        pool.waitBelow(maxInFlight);
+        pool.submit([this, file = normalize(file)] { refresh(file); });
+    }
+    pool.wait();
+}
+
+void SV::TagServer::watchTree(const std::string &dir, std::vector<std::string> &files) {
+    auto watch = [this](const std::string &path) {
+        int wd = ::inotify_add_watch(inotifyFd, path.c_str(), watchMask);
+        if (wd < 0) {
+            std::cerr << "WARN: Could not watch " << path << ": " << std::strerror(errno) << std::endl;
+            return;
+        }
+        watches[wd] = normalize(path);
+        watchCount = watches.size();
+    };
+    watch(dir);
+
+    std::error_code ec;
+    auto walkOptions = fs::directory_options::skip_permission_denied;
+    if (options.walkOptions.followSymlinks) walkOptions |= fs::directory_options::follow_directory_symlink;
+
+    for (auto it = fs::recursive_directory_iterator(dir, walkOptions, ec); it != fs::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) break;
+        std::string path = it->path().string();
+
+        if (it->is_directory(ec)) {
+            if (!DW::wantsDir(options.walkOptions, path)) {
+                it.disable_recursion_pending();
+                continue;
+            }
+            watch(path);
+        } else if (it->is_regular_file(ec) && DW::wantsFile(options.walkOptions, path)) {
+            files.push_back(normalize(path));
+        }
+    }
+}
+
+void SV::TagServer::handleEvents() {
+    alignas(inotify_event) char buffer[64 * 1024];
+
+    while (true) {
+        ssize_t length = ::read(inotifyFd, buffer, sizeof(buffer));
+        if (length <= 0) return;
+
+        for (char *pos = buffer; pos < buffer + length;) {
+            auto *event = reinterpret_cast<inotify_event *>(pos);
+            pos += sizeof(inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                // events were lost, only a full comparison with the disk can tell what changed
+                rescan();
+                continue;
+            }
+            if (event->mask & IN_IGNORED) {
+                watches.erase(event->wd);
+                watchCount = watches.size();
+                continue;
+            }
+
+            auto watched = watches.find(event->wd);
+            if (watched == watches.end() || event->len == 0) continue;
+            std::string path = (fs::path(watched->second) / event->name).string();
+
+            if (event->mask & IN_ISDIR) {
+                if (event->mask & (IN_CREATE | IN_MOVED_TO)) {
+                    if (!DW::wantsDir(options.walkOptions, path)) continue;
+                    // a whole tree can be moved in at once, it doesn't send an event per file
+                    std::vector<std::string> files;
+                    watchTree(path, files);
+                    for (auto &file : files) pool.submit([this, file] { refresh(file); });
+                } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                    forgetTree(path);
+                }
+            } else if (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) {
+                if (DW::wantsFile(options.walkOptions, path)) pool.submit([this, path] { refresh(path); });
+            } else if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                forget(path);
+            }
+        }
+    }
+}
+
+void SV::TagServer::rescan() {
+    std::vector<std::string> files;
+    for (auto &input : options.paths) {
+        std::string path = FH::cleanPath(input);
+        if (path.empty()) continue;
+        if (FH::pathIsDir(path)) {
+            watchTree(path, files);
+        } else {
+            files.push_back(normalize(path));
+        }
+    }
+
+    // drop everything that's gone, refresh only parses what changed
+    std::vector<std::string> known;
+    {
+        std::shared_lock lock(storeMutex);
+        for (auto &[path, record] : store) known.push_back(path);
+    }
+    std::ranges::sort(files);
+    for (auto &path : known) {
+        if (!std::ranges::binary_search(files, path)) forget(path);
+    }
+    for (auto &file : files) pool.submit([this, file] { refresh(file); });
+}
+
+void SV::TagServer::refresh(const std::string &path) {
+    TI::FileStamp stamp;
+    if (!TI::statFile(path, stamp)) {
+        forget(path);
+        return;
+    }
+
+    {
+        std::shared_lock lock(storeMutex);
+        auto it = store.find(path);
+        if (it != store.end() && it->second.stamp == stamp) return;
+    }
+
+    auto pool = currentValues();
+    TR::TagRecord tags;
+    std::optional<std::map<int, TagLib::StringList>> indexed;
+    if (options.index) indexed = options.index->lookup(path, stamp);
+
+    if (indexed) {
+        tags = TR::TagRecord(*indexed, *pool);
+    } else {
+        if (!FH::isSupportedAudio(path)) {
+            forget(path);
+            return;
+        }
+
+        // the same way read mode gets its properties
+        ST::Timer parseTimer (ST::PARSE);
+        auto propMap = FR::readTagProps(path);
+        if (!propMap) {
+            TagLib::FileRef f (path.data(), false);
+            if (f.isNull()) {
+                forget(path);
+                return;
+            }
+            propMap = f.properties();
+        }
+        parseTimer.stop();
+        tags = TR::TagRecord(*propMap, nullptr, *pool);
+        parsed++;
+
+        if (options.index) options.index->update(path, stamp, tags.toProps());
+    }
+
+    std::unique_lock lock(storeMutex);
+    storeRecord(path, stamp, tags);
+}
+
+std::shared_ptr<TR::ValuePool> SV::TagServer::currentValues() {
+    std::shared_lock lock(storeMutex);
+    return values;
+}
+
+void SV::TagServer::storeRecord(const std::string &path, const TI::FileStamp &stamp, const TR::TagRecord &tags) {
+    // made with a pool that was compacted away in the meantime
+    store[path] = {stamp, tags.valuePool() == values.get() ? tags : tags.moveTo(*values)};
+    tableStale = true;
+
+    if (values->count() < 2 * compactedCount + 4096) return;
+    auto compacted = std::make_shared<TR::ValuePool>();
+    for (auto &[storedPath, record] : store) record.tags = record.tags.moveTo(*compacted);
+    values = std::move(compacted);
+    compactedCount = values->count();
+}
+
+void SV::TagServer::forget(const std::string &path) {
+    std::unique_lock lock(storeMutex);
+    if (store.erase(path)) tableStale = true;
+}
+
+void SV::TagServer::forgetTree(const std::string &dir) {
+    std::string prefix = dir + "/";
+    std::unique_lock lock(storeMutex);
+    if (std::erase_if(store, [&prefix](const auto &entry) { return entry.first.starts_with(prefix); })) tableStale = true;
+}
+
+void SV::TagServer::reapClients() {
+    // moved out first, a thread that's still finishing only needs a moment but shouldn't hold up the others
+    std::vector<std::thread> finished;
+    {
+        std::lock_guard lock(clientMutex);
+        for (auto id : finishedClients) {
+            auto it = std::ranges::find(clientThreads, id, &std::thread::get_id);
+            if (it == clientThreads.end()) continue;
+            finished.push_back(std::move(*it));
+            clientThreads.erase(it);
+        }
+        finishedClients.clear();
+    }
+    for (auto &thread : finished) thread.join();
+}
+
+bool SV::TagServer::inLibrary(const std::string &path) const {
+    return std::ranges::any_of(roots, [&path](const std::string &root) {
+        return root.ends_with('/') ? path.starts_with(root) : path == root;
+    });
+}
+
+void SV::TagServer::serveClient(int fd) {
+    std::string pending;
+    char buffer[64 * 1024];
+
+    bool connected = true;
+    while (connected && !stopping) {
+        ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        pending.append(buffer, n);
+
+        // answer every complete line, a partial one waits for the rest
+        std::size_t start = 0;
+        for (std::size_t end; (end = pending.find('\n', start)) != std::string::npos; start = end + 1) {
+            std::string line = pending.substr(start, end - start);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+
+            std::string response;
+            try {
+                response = handleRequest(line);
+            } catch (const std::exception &e) {
+                response = errorLine(e.what());
+            }
+            if (!sendAll(fd, response)) {
+                connected = false;
+                break;
+            }
+        }
+        pending.erase(0, start);
+
+        if (connected && pending.size() > maxLineSize) {
+            sendAll(fd, errorLine("request line longer than " + std::to_string(maxLineSize / (1024 * 1024)) + " MiB"));
+            break;
+        }
+    }
+
+    {
+        std::lock_guard lock(clientMutex);
+        std::erase(clientFds, fd);
+        ::close(fd);
+        finishedClients.push_back(std::this_thread::get_id());
+    }
+    wake();
+}
+
+std::string SV::TagServer::handleRequest(const std::string &line) {
+    auto fields = splitFields(line);
+    std::string command = upper(fields[0]);
+
+    if (command == "PING") return "{\"ok\":true}\n";
+    if (command == "READ") return readRequest(fields);
+    if (command == "WRITE") return writeRequest(fields);
+    if (command == "LIST") return listRequest(fields);
+    if (command == "QUERY") return queryRequest(fields);
+    if (command == "STATS") return statsRequest();
+    return errorLine("unknown command " + fields[0]);
+}
+
+std::string SV::TagServer::readRequest(const std::vector<std::string> &fields) {
+    if (fields.size() < 2) return errorLine("READ needs a path");
+    std::string path = normalize(fields[1]);
+    if (!inLibrary(path)) return errorLine("not in the library: " + fields[1]);
+
+    std::unordered_set<int> requested;
+    for (std::size_t i = 2; i < fields.size(); i++) {
+        int type = TM::findPropTypeByKey(upper(fields[i]));
+        if (type == TM::UNDEFINED) return errorLine("unknown tag key " + fields[i]);
+        requested.insert(type);
+    }
+
+    // only a stat if the file is stored and unchanged, but files that aren't watched (library paths that are files,
+    // files the walk options skip) and files not stored yet are brought up to date here
+    refresh(path);
+
+    std::shared_lock lock(storeMutex);
+    auto it = store.find(path);
+    if (it == store.end()) return errorLine("not a supported file: " + fields[1]);
+
+    std::ostringstream out;
+    OW::writeRecord(out, OW::NDJSON, path, requested.empty() ? it->second.tags.toProps() : it->second.tags.toProps(requested), {});
+    return out.str();
+}
+
+std::string SV::TagServer::writeRequest(const std::vector<std::string> &fields) {
+    if (fields.size() < 3) return errorLine("WRITE needs a path and at least one KEY=VALUE");
+    std::string path = normalize(fields[1]);
+    if (!inLibrary(path)) return errorLine("not in the library: " + fields[1]);
+
+    TM::EditBatch batch;
+    batch.padding = options.padding;
+    for (std::size_t i = 2; i < fields.size(); i++) {
+        auto separator = fields[i].find('=');
+        if (separator == std::string::npos) return errorLine("expected KEY=VALUE, got " + fields[i]);
+
+        std::string key = upper(fields[i].substr(0, separator));
+        std::string value = fields[i].substr(separator + 1);
+
+        if (key == "PICTURE") {
+            batch.replacePictures = true;
+            for (std::size_t start = 0; start <= value.size();) {
+                std::size_t end = std::min(value.find(';', start), value.size());
+                if (end > start) batch.pictures.push_back(value.substr(start, end - start));
+                start = end + 1;
+            }
+            continue;
+        }
+
+        int type = TM::findPropTypeByKey(key);
+        if (type == TM::UNDEFINED) return errorLine("unknown tag key " + key);
+        batch.propLists[type] = value.empty() ? TagLib::StringList() : TagLib::StringList(TagLib::String(value, TagLib::String::UTF8));
+    }
+
+    TM::commitResults result;
+    auto pool = currentValues();
+    TR::TagRecord tags;
+    {
+        std::lock_guard lock(writeMutex);
+        TagLib::FileRef f (path.data());
+        if (f.isNull()) return errorLine("not a supported file: " + fields[1]);
+
+        result = TM::commitEdits(f, batch);
+        if (!result) return errorLine("could not save " + fields[1]);
+        tags = TR::TagRecord(f.properties(), nullptr, *pool);
+    }
+
+    // stored right away, the inotify event of the save then finds the file unchanged
+    TI::FileStamp stamp;
+    if (TI::statFile(path, stamp)) {
+        if (options.index) options.index->update(path, stamp, tags.toProps());
+        std::unique_lock lock(storeMutex);
+        storeRecord(path, stamp, tags);
+    }
+
+    return "{\"file\":\"" + OW::escapeJson(path) + "\",\"result\":\"" + std::string(TM::commitResultName(result)) + "\"}\n";
+}
+
+std::string SV::TagServer::listRequest(const std::vector<std::string> &fields) {
+    std::string prefix = fields.size() > 1 && !fields[1].empty() ? normalize(fields[1]) : "";
+
+    std::ostringstream out;
+    std::size_t count = 0;
+    {
+        std::shared_lock lock(storeMutex);
+        std::vector<const std::pair<const std::string, Record> *> matches;
+        for (auto &entry : store) {
+            if (entry.first.starts_with(prefix)) matches.push_back(&entry);
+        }
+        std::ranges::sort(matches, {}, [](auto *entry) { return entry->first; });
+
+        for (auto *entry : matches) {
+            OW::writeRecord(out, OW::NDJSON, entry->first, entry->second.tags.toProps(), {});
+        }
+        count = matches.size();
+    }
+    out << "{\"end\":true,\"count\":" << count << "}\n";
+    return out.str();
+}
+
+std::string SV::TagServer::queryRequest(const std::vector<std::string> &fields) {
+    QY::Query query;
+    try {
+        query = QY::parseQuery({fields.begin() + 1, fields.end()});
+    } catch (const std::invalid_argument &e) {
+        return errorLine(e.what());
+    }
+
+    std::ostringstream out;
+    std::size_t count = 0;
+    {
+        // the store lock is held throughout, so the table can't go stale while it's being used
+        std::shared_lock storeLock(storeMutex);
+        std::lock_guard tableLock(tableMutex);
+
+        if (tableStale.exchange(false)) {
+            std::vector<const std::string *> paths;
+            paths.reserve(store.size());
+            for (auto &[path, record] : store) paths.push_back(&path);
+            std::ranges::sort(paths, {}, [](auto *path) { return *path; });
+
+            table.clear();
+            for (auto *path : paths) table.add(*path, store.at(*path).tags.toProps());
+        }
+
+        auto rows = table.select(query);
+        for (std::uint32_t row : rows) {
+            auto &path = table.path(row);
+            OW::writeRecord(out, OW::NDJSON, path, store.at(path).tags.toProps(), {});
+        }
+        count = rows.size();
+    }
+    out << "{\"end\":true,\"count\":" << count << "}\n";
+    return out.str();
+}
+
+std::string SV::TagServer::statsRequest() {
+    std::size_t files;
+    {
+        std::shared_lock lock(storeMutex);
+        files = store.size();
+    }
+    std::size_t clients;
+    {
+        std::lock_guard lock(clientMutex);
+        clients = clientFds.size();
+    }
+
+    return "{\"files\":" + std::to_string(files)
+        + ",\"parsed\":" + std::to_string(parsed.load())
+        + ",\"watches\":" + std::to_string(watchCount.load())
+        + ",\"clients\":" + std::to_string(clients) + "}\n";
+}
@@ -0,0 +1,143 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <tstringlist.h>
+#include <unordered_map>
+#include <vector>
+
+#include "dir_walker.h"
+#include "query.h"
+#include "tag_index.h"
+#include "tag_record.h"
+#include "work_pool.h"
+
+namespace SV {
+    struct ServeOptions {
+        // unix domain socket the clients connect to
+        std::string socketPath;
+        // library files and directories, directories are watched for changes
+        std::vector<std::string> paths;
+        DW::WalkOptions walkOptions;
+        // files (re-)parsed at the same time
+        unsigned int jobs = 1;
+        // optional index, used to load unchanged files without parsing them and kept up to date
+        TI::TagIndex *index = nullptr;
+        // padding for writes, see TM::EditBatch
+        std::uint64_t padding = 4096;
+        bool verbose = false;
+    };
+
+    // keeps every defined property of the whole library in memory and answers local clients from it
+    // directories are watched with inotify, so only files that actually changed are parsed again
+    //
+    // clients send one request per line, fields separated by tabs (escaped like TSV output, see OW::escapeTsv)
+    // every request gets exactly one NDJSON line back, except LIST which ends with an {"end":true,...} line
+    //   PING
+    //   READ <path> [KEY...]                 -> {"file":...,"tags":{...}} like --format ndjson, all tags without keys
+    //   WRITE <path> KEY=VALUE... [PICTURE=a.jpg;b.png]
+    //                                        -> {"file":...,"result":"in place"}, an empty VALUE removes the tag
+    //   LIST [path prefix]                   -> one record per file, sorted by path
+    //   QUERY <condition>...                 -> the records matching all --where style conditions, like LIST
+    //   STATS                                -> {"files":...,"parsed":...,"watches":...,"clients":...}
+    // errors are answered with {"error":"..."}
+    // READ and WRITE only accept files inside the library paths, anything else is answered with an error
+    class TagServer {
+    public:
+        explicit TagServer(ServeOptions options);
+        ~TagServer();
+
+        TagServer(const TagServer &) = delete;
+        TagServer &operator=(const TagServer &) = delete;
+
+        // load the library, then watch it and serve clients until SIGINT/SIGTERM or stop()
+        // false if the socket or the watches couldn't be set up
+        bool run();
+
+        // safe to call from any thread (and from a signal handler)
+        void stop();
+
+    private:
+        struct Record {
+            TI::FileStamp stamp;
+            // values repeated across the library (artists, albums, genres...) are only stored once
+            TR::TagRecord tags;
+        };
+
+        bool openSocket();
+        void load();
+        void watchTree(const std::string& dir, std::vector<std::string> &files);
+        void handleEvents();
+        void rescan();
+
+        // parse path again if it changed since it was stored, drop it if it's gone or unsupported
+        void refresh(const std::string& path);
+        // put a record into the store, storeMutex has to be held exclusively
+        void storeRecord(const std::string& path, const TI::FileStamp &stamp, const TR::TagRecord &tags);
+        // the pool new records are made with
+        std::shared_ptr<TR::ValuePool> currentValues();
+        void forget(const std::string& path);
+        void forgetTree(const std::string& dir);
+
+        // whether path (normalized) is one of the library paths or inside one of the library directories
+        bool inLibrary(const std::string& path) const;
+        // let the event loop join the threads of clients that disconnected
+        void wake();
+        void reapClients();
+
+        void serveClient(int fd);
+        std::string handleRequest(const std::string& line);
+        std::string readRequest(const std::vector<std::string> &fields);
+        std::string writeRequest(const std::vector<std::string> &fields);
+        std::string listRequest(const std::vector<std::string> &fields);
+        std::string queryRequest(const std::vector<std::string> &fields);
+        std::string statsRequest();
+
+        ServeOptions options;
+        // options.paths normalized, directories with a trailing slash
+        std::vector<std::string> roots;
+
+        std::shared_mutex storeMutex;
+        std::unordered_map<std::string, Record> store;
+        // the values of every record in the store, replaced by a compacted copy once it has grown to twice the values
+        // it had after the last compaction, so values that were overwritten or re-parsed don't pile up forever
+        // records made while it's being replaced keep the old pool alive until they're stored
+        std::shared_ptr<TR::ValuePool> values = std::make_shared<TR::ValuePool>();
+        std::size_t compactedCount = 0;
+        // writes go through TagLib one at a time, so two clients can't save the same file at once
+        std::mutex writeMutex;
+
+        // column copy of the store for QUERY, rebuilt by the first query after the store changed
+        // so repeated queries are scans over the columns they use
+        QY::Table table;
+        std::mutex tableMutex;
+        std::atomic<bool> tableStale = true;
+
+        // re-parses triggered by inotify run here instead of on the event loop
+        WP::WorkPool pool;
+
+        int listenFd = -1;
+        int inotifyFd = -1;
+        // written to by stop() and by finishing clients, wakes up the event loop
+        int wakeFds[2] = {-1, -1};
+        // only touched by the event loop, STATS reads watchCount instead
+        std::unordered_map<int, std::string> watches;
+        std::atomic<std::size_t> watchCount = 0;
+
+        std::mutex clientMutex;
+        std::vector<int> clientFds;
+        std::list<std::thread> clientThreads;
+        // threads of disconnected clients, joined by the event loop
+        std::vector<std::thread::id> finishedClients;
+
+        std::atomic<std::size_t> parsed = 0;
+        std::atomic<bool> stopping = false;
+    };
+}
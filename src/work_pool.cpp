@@ -0,0 +1,176 @@
+#include "work_pool.h"
+
+#include <iostream>
+#include <sstream>
+
+#include "stats.h"
+
+unsigned int WP::resolveJobCount(unsigned int requested) {
+    if (requested > 0) return requested;
+
+    // hardware_concurrency is allowed to return 0 if it can't tell
+    unsigned int hw = std::thread::hardware_concurrency();
+    return hw > 0 ? hw : 1;
+}
+
+WP::WorkPool::WorkPool(unsigned int jobs) {
+    // a single job runs everything inline, so there is nothing to set up
+    if (jobs <= 1) return;
+
+    for (unsigned int i = 0; i < jobs; i++) {
+        workers.push_back(std::make_unique<Worker>());
+    }
+    for (unsigned int i = 0; i < jobs; i++) {
+        threads.emplace_back(&WorkPool::run, this, i);
+    }
+}
+
+WP::WorkPool::~WorkPool() {
+    wait();
+
+    {
+        std::lock_guard lock(stateMutex);
+        stopping = true;
+    }
+    taskAvailable.notify_all();
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+}
+
+unsigned int WP::WorkPool::size() const {
+    return threads.empty() ? 1 : threads.size();
+}
+
+void WP::WorkPool::submit(Task task) {
+    if (workers.empty()) {
+        execute(task);
+        return;
+    }
+
+    pending++;
+
+    {
+        // submit is only called from one thread, so nextWorker doesn't need extra protection
+        auto &worker = *workers[nextWorker];
+        nextWorker = (nextWorker + 1) % workers.size();
+
+        std::lock_guard lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+
+    {
+        // queued is increased under the state lock so a worker checking it before going to sleep can't miss the wakeup
+        std::lock_guard lock(stateMutex);
+        queued++;
+    }
+    taskAvailable.notify_one();
+}
+
+void WP::WorkPool::wait() {
+    waitBelow(1);
+}
+
+void WP::WorkPool::waitBelow(std::size_t limit) {
+    if (workers.empty()) return;
+
+    std::unique_lock lock(stateMutex);
+    taskFinished.wait(lock, [this, limit] { return pending < limit; });
+}
+
+void WP::WorkPool::run(unsigned int idx) {
+    while (true) {
+        Task task;
+        if (popLocal(idx, task) || steal(idx, task)) {
+            queued--;
+            execute(task);
+
+            pending--;
+            {
+                std::lock_guard lock(stateMutex);
+                taskFinished.notify_all();
+            }
+            continue;
+        }
+
+        // nothing to take or steal, sleep until something is submitted
+        std::unique_lock lock(stateMutex);
+        taskAvailable.wait(lock, [this] { return stopping || queued > 0; });
+        if (stopping && queued == 0) return;
+    }
+}
+
+bool WP::WorkPool::popLocal(unsigned int idx, Task &task) {
+    auto &worker = *workers[idx];
+    std::lock_guard lock(worker.mutex);
+
+    if (worker.tasks.empty()) return false;
+    task = std::move(worker.tasks.front());
+    worker.tasks.pop_front();
+    return true;
+}
+
+bool WP::WorkPool::steal(unsigned int idx, Task &task) {
+    // start with the next worker so thieves don't all pile onto worker 0
+    for (std::size_t i = 1; i < workers.size(); i++) {
+        auto &victim = *workers[(idx + i) % workers.size()];
+        std::lock_guard lock(victim.mutex);
+
+        if (victim.tasks.empty()) continue;
+        task = std::move(victim.tasks.back());
+        victim.tasks.pop_back();
+        return true;
+    }
+    return false;
+}
+
+void WP::WorkPool::execute(Task &task) {
+    // an exception must not take down the worker thread along with all tasks queued behind it
+    try {
+        task();
+    } catch (const std::exception &e) {
+        std::cerr << "Exception while processing a file: " << e.what() << std::endl;
+    }
+}
+
+WP::OrderedOutput::OrderedOutput(std::ostream &out) : out(out) {}
+
+std::size_t WP::OrderedOutput::reserve() {
+    std::lock_guard lock(mutex);
+    return nextTicket++;
+}
+
+void WP::OrderedOutput::complete(std::size_t ticket, std::string text) {
+    std::lock_guard lock(mutex);
+    finished.emplace(ticket, std::move(text));
+
+    // write out everything that is now contiguous with what was already written
+    for (auto it = finished.begin(); it != finished.end() && it->first == nextToWrite; it = finished.erase(it)) {
+        ST::Timer timer (ST::OUTPUT);
+        out << it->second;
+        nextToWrite++;
+    }
+    written.notify_all();
+}
+
+void WP::OrderedOutput::waitBelow(std::size_t limit) {
+    std::unique_lock lock(mutex);
+    written.wait(lock, [this, limit] { return nextTicket - nextToWrite < limit; });
+}
+
+std::size_t WP::forEachOrdered(const std::vector<std::string> &items, unsigned int jobs, std::ostream &out, const ItemFn &fn) {
+    std::size_t idx = 0;
+    return forEachOrdered(
+        [&](std::string &item) {
+            if (idx >= items.size()) return false;
+            item = items[idx++];
+            return true;
+        },
+        jobs, out, fn
+    );
+}
+
+std::size_t WP::forEachOrdered(const ItemSource &next, unsigned int jobs, std::ostream &out, const ItemFn &fn) {
+    return forEachOrdered<std::string>(next, jobs, out, fn);
+}
@@ -0,0 +1,188 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace WP {
+    using Task = std::function<void()>;
+
+    // resolve the --jobs value, 0 meaning "one worker per hardware thread"
+    unsigned int resolveJobCount(unsigned int requested);
+
+    // work-stealing thread pool
+    // every worker owns a deque, submitted tasks are spread over them round-robin
+    // a worker takes tasks from the front of its own deque and steals from the back of the others once it runs dry
+    // with a single job no threads are started and every task runs inline on submit
+    class WorkPool {
+    public:
+        explicit WorkPool(unsigned int jobs);
+        ~WorkPool();
+
+        WorkPool(const WorkPool &) = delete;
+        WorkPool &operator=(const WorkPool &) = delete;
+
+        void submit(Task task);
+
+        // block until every submitted task has finished
+        void wait();
+
+        // block until fewer than limit tasks are waiting or running, keeps a fast producer from queueing everything at once
+        void waitBelow(std::size_t limit);
+
+        unsigned int size() const;
+
+    private:
+        struct Worker {
+            std::deque<Task> tasks;
+            std::mutex mutex;
+        };
+
+        void run(unsigned int idx);
+        bool popLocal(unsigned int idx, Task &task);
+        bool steal(unsigned int idx, Task &task);
+        void execute(Task &task);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::vector<std::thread> threads;
+
+        std::mutex stateMutex;
+        std::condition_variable taskAvailable;
+        std::condition_variable taskFinished;
+        std::atomic<std::size_t> queued = 0;  // tasks sitting in a deque
+        std::atomic<std::size_t> pending = 0; // tasks submitted but not finished yet
+        unsigned int nextWorker = 0;
+        bool stopping = false;
+    };
+
+    // keeps the output of every file together and writes it in the order the files were submitted
+    // a ticket is reserved before the task is submitted, the finished text is handed back with complete()
+    // out is never flushed here, that's left to the stream's own buffering
+    class OrderedOutput {
+    public:
+        explicit OrderedOutput(std::ostream &out);
+
+        std::size_t reserve();
+        void complete(std::size_t ticket, std::string text);
+
+        // block until fewer than limit reserved tickets are still unwritten, whether they're running or done and buffered
+        void waitBelow(std::size_t limit);
+
+    private:
+        std::ostream &out;
+        std::mutex mutex;
+        std::condition_variable written;
+        std::size_t nextTicket = 0;
+        std::size_t nextToWrite = 0;
+        std::map<std::size_t, std::string> finished; // completed out of order, waiting for earlier tickets
+    };
+
+    // fixed capacity queue between a producer and the pool, push blocks while it's full
+    template <typename T>
+    class BoundedQueue {
+    public:
+        explicit BoundedQueue(std::size_t capacity) : capacity(capacity) {}
+
+        // false if the queue was closed in the meantime, the item is dropped then
+        bool push(T item) {
+            std::unique_lock lock(mutex);
+            notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+            if (closed) return false;
+
+            items.push_back(std::move(item));
+            notEmpty.notify_one();
+            return true;
+        }
+
+        // blocks until there is an item, false once the queue is closed and everything was taken out
+        bool pop(T &item) {
+            std::unique_lock lock(mutex);
+            notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+            if (items.empty()) return false;
+
+            item = std::move(items.front());
+            items.pop_front();
+            notFull.notify_one();
+            return true;
+        }
+
+        // no more pushes are accepted, what's already queued can still be popped
+        void close() {
+            std::lock_guard lock(mutex);
+            closed = true;
+            notFull.notify_all();
+            notEmpty.notify_all();
+        }
+
+    private:
+        std::size_t capacity;
+        std::deque<T> items;
+        std::mutex mutex;
+        std::condition_variable notFull;
+        std::condition_variable notEmpty;
+        bool closed = false;
+    };
+
+    // name of an item in error messages, overloaded next to other item types (found through ADL)
+    inline const std::string &itemLabel(const std::string &item) {
+        return item;
+    }
+
+    // run fn for every item pulled from next on a pool of the given size
+    // fn writes into its own stream, which is written to out in the same order as the items once it is done
+    // returns the number of processed items
+    template <typename T>
+    std::size_t forEachOrdered(const std::function<bool(T &)> &next, unsigned int jobs, std::ostream &out, const std::function<void(const T &, std::ostream &)> &fn) {
+        OrderedOutput output (out);
+        // declared after output so the pool is destroyed (and all tasks are finished) first
+        WorkPool pool (jobs);
+
+        // how many items may be unwritten at once, every queued or running task holds one of those tickets
+        // so this bounds both the task queues and the output buffered behind a slow item
+        const std::size_t maxInFlight = pool.size() * 64;
+
+        std::size_t count = 0;
+        T item;
+        while (next(item)) {
+            output.waitBelow(maxInFlight);
+
+            std::size_t ticket = output.reserve();
+            count++;
+
+            pool.submit([&output, &fn, item = std::move(item), ticket] {
+                std::ostringstream itemOut;
+                // the ticket has to be completed no matter what, otherwise the output of every later item gets stuck
+                try {
+                    fn(item, itemOut);
+                } catch (const std::exception &e) {
+                    std::cerr << "Exception while processing " << itemLabel(item) << ": " << e.what() << std::endl;
+                }
+                output.complete(ticket, itemOut.str());
+            });
+            item = T {};
+        }
+
+        pool.wait();
+        return count;
+    }
+
+    // produces the next item to process, false once there are no more
+    using ItemSource = std::function<bool(std::string &)>;
+    using ItemFn = std::function<void(const std::string &, std::ostream &)>;
+
+    // forEachOrdered over a fixed list of paths
+    std::size_t forEachOrdered(const std::vector<std::string> &items, unsigned int jobs, std::ostream &out, const ItemFn &fn);
+
+    // forEachOrdered over paths that become available over time (e.g. while a directory is still being walked)
+    std::size_t forEachOrdered(const ItemSource &next, unsigned int jobs, std::ostream &out, const ItemFn &fn);
+}